@@ -0,0 +1,643 @@
+// Microbenchmarks of the engine hot paths and the draw functions. Every run
+// works on the same seeded boards, so results can be saved as a baseline
+// and later runs checked against it
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "collide.h"
+#include "game.h"
+#include "perfect.h"
+#ifndef BENCH_NO_DRAW
+#include "draw.h"
+#include "graphics.h"
+#endif
+
+// Boards in the corpus and pieces tried against them, both powers of two
+#define CORPUS_SIZE 64
+#define PROBE_COUNT 1024
+#define CORPUS_SEED 0x5EED
+// Highest a corpus board is filled, leaves the top rows free for spawning
+#define MAX_GARBAGE 14
+// Each benchmark is timed this many times, each at least SAMPLE_NS long
+#define SAMPLES 15
+#define SAMPLE_NS 20000000
+// Percent slower than the baseline that counts as a regression
+#define DEFAULT_THRESHOLD 5.0
+#define MAX_BENCHES 32
+
+// Runs the operation n times. Returns something depending on every result
+// so the compiler can't throw the work away
+typedef Uint64 (*BenchFunc)(Uint64 n);
+
+typedef struct {
+	const char *name;
+	BenchFunc run;
+	// Collide kernel the benchmark needs, it is skipped if the CPU doesn't
+	// support it
+	const char *kernel;
+	// Per candidate benchmark this one is a faster way of doing
+	const char *versus;
+} Bench;
+
+// Per operation in ns. The median is what gets compared, a few samples
+// slowed down by something else on the machine barely move it
+typedef struct {
+	char name[32];
+	double median, mean, stddev, min;
+} BenchResult;
+
+// Seeded boards with a ragged stack of garbage, and pieces placed anywhere
+// on and around the stage to test against them
+GameState Boards[CORPUS_SIZE];
+Piece Probes[PROBE_COUNT];
+// Pieces at the top of the stage that fit on every board
+Piece Drops[PROBE_COUNT];
+// Boards where locking their piece clears 0 to 4 rows
+GameState ClearBoards[5][CORPUS_SIZE];
+// The corpus boards laid out for the collide kernels, and again with 6
+// empty columns on the right for the kernel stages that wide use
+CollideBoard CollideBoards[CORPUS_SIZE];
+CollideBoard WideBoards[CORPUS_SIZE];
+// The perfect clear opener part way through: the bottom 4 rows filled on
+// the left, 24 cells for the 7 pieces current, hold and queue can see
+#define OPENER_COUNT 8
+#define OPENER_COLUMNS 4
+GameState Openers[OPENER_COUNT];
+PcResult Solved;
+
+volatile Uint64 sink;
+
+static void set_block(GameState *g, int x, int y, int type) {
+	Row old = g->stage.rows[y];
+	g->stage.rows[y] |= 1 << x;
+	g->stage.hash ^= zobrist_row(y, old) ^ zobrist_row(y, g->stage.rows[y]);
+	g->stage.color[y][x] = type + 1;
+	if(y < g->stage.surface[x]) g->stage.surface[x] = y;
+}
+
+// Fills row y except for the columns in holes
+static void fill_row(GameState *g, Rng *r, int y, Row holes) {
+	for(int x = 0; x < STAGE_W; x++) {
+		if(!(holes & 1 << x)) set_block(g, x, y, rng_below(r, 7));
+	}
+}
+
+// Any x the piece fits at horizontally
+static int random_x(Rng *r, Piece p) {
+	const PieceShape *s = &PieceShapes[p.type][p.flip];
+	return rng_below(r, STAGE_W - (s->maxX - s->minX)) - s->minX;
+}
+
+// The same stage with empty columns added on the right up to MAX_STAGE_W
+static void widen_stage(Stage *s) {
+	memset(s->surface + s->size.width, s->size.height, MAX_STAGE_W - s->size.width);
+	s->size.width = MAX_STAGE_W;
+	s->full = (Row)((1 << MAX_STAGE_W) - 1);
+}
+
+// Every kernel this CPU supports has to give the same answers as
+// validate_piece and drop_distance over the whole corpus, or timing it
+// means nothing. Returns how many don't
+static int check_kernels() {
+	int failed = 0;
+	for(int k = 0; k < CollideKernelCount; k++) {
+		const CollideKernel *kernel = &CollideKernels[k];
+		if(!kernel->supported()) continue;
+		bool wide = kernel->maxWidth > COLLIDE_NARROW;
+		int wrong = 0;
+		for(int i = 0; i < CORPUS_SIZE; i++) {
+			GameState g = Boards[i];
+			if(wide) widen_stage(&g.stage);
+			const CollideBoard *b = wide ? &WideBoards[i] : &CollideBoards[i];
+			for(int j = 0; j < PROBE_COUNT; j += COLLIDE_BATCH) {
+				Uint64 hits = kernel->collide(b, &Probes[j], COLLIDE_BATCH);
+				Uint8 out[COLLIDE_BATCH];
+				kernel->drop(b, &Drops[j], COLLIDE_BATCH, out);
+				for(int c = 0; c < COLLIDE_BATCH; c++) {
+					wrong += (bool)(hits >> c & 1) == validate_piece(&g, Probes[j + c]);
+					wrong += out[c] != drop_distance(&g, Drops[j + c]);
+				}
+			}
+		}
+		if(wrong) {
+			fprintf(stderr, "%s kernel disagrees with validate_piece or drop_distance %d times\n",
+				kernel->name, wrong);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+// Plays every solution pc_solve finds for the openers, with hold_piece and
+// lock_piece the way a player would, and checks each one leaves the stage
+// empty. Returns how many don't, or 1 if there were none to play
+static int check_solutions() {
+	int failed = 0;
+	Uint64 played = 0;
+	for(int i = 0; i < OPENER_COUNT; i++) {
+		pc_solve(&Openers[i], 1, 1000000000, NULL, &Solved);
+		for(int j = 0; j < Solved.count; j++, played++) {
+			const PcSolution *s = &Solved.solutions[j];
+			GameState g = Openers[i];
+			bool ok = true;
+			for(int k = 0; ok && k < s->count; k++) {
+				if(s->steps[k].hold) hold_piece(&g);
+				ok = g.piece.type == s->steps[k].piece.type && validate_piece(&g, s->steps[k].piece);
+				g.piece = s->steps[k].piece;
+				if(ok) lock_piece(&g);
+			}
+			for(int y = 0; ok && y < STAGE_H; y++) ok = g.stage.rows[y] == 0;
+			if(!ok) {
+				fprintf(stderr, "pc_solve/opener %d solution %d doesn't clear the stage\n", i, j);
+				failed++;
+			}
+		}
+	}
+	if(played == 0) {
+		fprintf(stderr, "pc_solve/opener finds no solutions to check\n");
+		return 1;
+	}
+	return failed;
+}
+
+// Returns how many of the sanity checks on it failed
+static int build_corpus() {
+	Rng r;
+	rng_seed(&r, CORPUS_SEED);
+	for(int i = 0; i < CORPUS_SIZE; i++) {
+		GameState *g = &Boards[i];
+		game_seed(g, CORPUS_SEED + i);
+		int height = rng_below(&r, MAX_GARBAGE + 1);
+		for(int y = STAGE_H - height; y < STAGE_H; y++) {
+			// One guaranteed hole, and the odd extra one
+			Row holes = 1 << rng_below(&r, STAGE_W);
+			for(int x = 0; x < STAGE_W; x++) {
+				if(rng_below(&r, 5) == 0) holes |= 1 << x;
+			}
+			fill_row(g, &r, y, holes);
+		}
+	}
+	for(int i = 0; i < PROBE_COUNT; i++) {
+		Piece p = { 0, 0, rng_below(&r, 7), rng_below(&r, 4) };
+		p.x = rng_below(&r, STAGE_W + 3) - 2;
+		p.y = rng_below(&r, STAGE_H + 3) - 2;
+		Probes[i] = p;
+		p.x = random_x(&r, p);
+		p.y = 0;
+		Drops[i] = p;
+	}
+	for(int i = 0; i < CORPUS_SIZE; i++) {
+		collide_board(&CollideBoards[i], &Boards[i].stage);
+		Stage wide = Boards[i].stage;
+		widen_stage(&wide);
+		collide_board(&WideBoards[i], &wide);
+	}
+	int failed = check_kernels();
+	// A vertical I dropped into a well that is full for the bottom k rows
+	Piece well = { 0, 0, 1, 0 };
+	while(PieceShapes[1][well.flip].minX != PieceShapes[1][well.flip].maxX) well.flip++;
+	const PieceShape *s = &PieceShapes[1][well.flip];
+	for(int k = 0; k <= 4; k++) {
+		for(int i = 0; i < CORPUS_SIZE; i++) {
+			GameState *g = &ClearBoards[k][i];
+			game_seed(g, CORPUS_SEED + i);
+			int column = rng_below(&r, STAGE_W);
+			for(int y = STAGE_H - 4; y < STAGE_H; y++) {
+				Row holes = 1 << column;
+				// Rows above the bottom k keep a second hole
+				if(y < STAGE_H - k) holes |= 1 << (column + 1 + rng_below(&r, STAGE_W - 1)) % STAGE_W;
+				fill_row(g, &r, y, holes);
+			}
+			Piece p = well;
+			p.x = column - s->minX;
+			g->piece = ghost_piece(g, p);
+		}
+		GameState g = ClearBoards[k][0];
+		lock_piece(&g);
+		if(g.linesCleared != k) {
+			fprintf(stderr, "lock_piece/%d clears %d rows instead\n", k, g.linesCleared);
+			failed++;
+		}
+	}
+	for(int i = 0; i < OPENER_COUNT; i++) {
+		GameState *g = &Openers[i];
+		game_seed(g, CORPUS_SEED + i);
+		hold_piece(g);
+		g->holded = false;
+		for(int y = STAGE_H - 4; y < STAGE_H; y++) {
+			for(int x = 0; x < OPENER_COLUMNS; x++) set_block(g, x, y, rng_below(&r, 7));
+		}
+	}
+	return failed + check_solutions();
+}
+
+static Uint64 bench_validate_piece(Uint64 n) {
+	Uint64 sum = 0;
+	for(Uint64 i = 0; i < n; i++) {
+		sum += validate_piece(&Boards[i % CORPUS_SIZE], Probes[(i / CORPUS_SIZE) % PROBE_COUNT]);
+	}
+	return sum;
+}
+
+static Uint64 bench_wall_kick(Uint64 n) {
+	Uint64 sum = 0;
+	for(Uint64 i = 0; i < n; i++) {
+		Piece p = Probes[(i / CORPUS_SIZE) % PROBE_COUNT];
+		sum += wall_kick(&Boards[i % CORPUS_SIZE], &p) + p.x;
+	}
+	return sum;
+}
+
+static Uint64 bench_ghost_piece(Uint64 n) {
+	Uint64 sum = 0;
+	for(Uint64 i = 0; i < n; i++) {
+		sum += ghost_piece(&Boards[i % CORPUS_SIZE], Drops[(i / CORPUS_SIZE) % PROBE_COUNT]).y;
+	}
+	return sum;
+}
+
+// The same candidates as validate_piece, a batch per board. An
+// operation is one candidate
+static Uint64 bench_collide(Uint64 n, const char *kernel) {
+	const CollideKernel *k = collide_find(kernel);
+	const CollideBoard *boards = k->maxWidth > COLLIDE_NARROW ? WideBoards : CollideBoards;
+	Uint64 sum = 0;
+	for(Uint64 i = 0; i < n; i += COLLIDE_BATCH) {
+		int count = n - i < COLLIDE_BATCH ? n - i : COLLIDE_BATCH;
+		Uint64 batch = i / COLLIDE_BATCH;
+		sum += k->collide(&boards[batch % CORPUS_SIZE],
+			&Probes[batch * COLLIDE_BATCH % PROBE_COUNT], count);
+	}
+	return sum;
+}
+
+static Uint64 bench_collide_avx2(Uint64 n) { return bench_collide(n, "avx2"); }
+static Uint64 bench_collide_sse2(Uint64 n) { return bench_collide(n, "sse2"); }
+static Uint64 bench_collide_scalar(Uint64 n) { return bench_collide(n, "scalar"); }
+static Uint64 bench_collide_wide(Uint64 n) { return bench_collide(n, "wide"); }
+
+// The same candidates as ghost_piece, a batch per board
+static Uint64 bench_drop(Uint64 n, const char *kernel) {
+	const CollideKernel *k = collide_find(kernel);
+	const CollideBoard *boards = k->maxWidth > COLLIDE_NARROW ? WideBoards : CollideBoards;
+	Uint8 out[COLLIDE_BATCH];
+	Uint64 sum = 0;
+	for(Uint64 i = 0; i < n; i += COLLIDE_BATCH) {
+		int count = n - i < COLLIDE_BATCH ? n - i : COLLIDE_BATCH;
+		Uint64 batch = i / COLLIDE_BATCH;
+		k->drop(&boards[batch % CORPUS_SIZE],
+			&Drops[batch * COLLIDE_BATCH % PROBE_COUNT], count, out);
+		sum += out[0] + out[count - 1];
+	}
+	return sum;
+}
+
+static Uint64 bench_drop_avx2(Uint64 n) { return bench_drop(n, "avx2"); }
+static Uint64 bench_drop_sse2(Uint64 n) { return bench_drop(n, "sse2"); }
+static Uint64 bench_drop_scalar(Uint64 n) { return bench_drop(n, "scalar"); }
+static Uint64 bench_drop_wide(Uint64 n) { return bench_drop(n, "wide"); }
+
+// What the operations below that change the board pay first to start
+// from a clean copy
+static Uint64 bench_copy(Uint64 n) {
+	Uint64 sum = 0;
+	GameState g;
+	for(Uint64 i = 0; i < n; i++) {
+		g = Boards[i % CORPUS_SIZE];
+		// Otherwise the compiler only copies the one row read below
+		__asm__ volatile("" : : "r"(&g) : "memory");
+		sum += g.stage.rows[STAGE_H - 1];
+	}
+	return sum;
+}
+
+static Uint64 bench_hard_drop(Uint64 n) {
+	Uint64 sum = 0;
+	GameState g;
+	for(Uint64 i = 0; i < n; i++) {
+		g = Boards[i % CORPUS_SIZE];
+		g.piece = Drops[(i / CORPUS_SIZE) % PROBE_COUNT];
+		hard_drop(&g);
+		sum += g.score;
+	}
+	return sum;
+}
+
+static Uint64 bench_lock_piece(Uint64 n, int k) {
+	Uint64 sum = 0;
+	GameState g;
+	for(Uint64 i = 0; i < n; i++) {
+		g = ClearBoards[k][i % CORPUS_SIZE];
+		lock_piece(&g);
+		sum += g.score;
+	}
+	return sum;
+}
+
+static Uint64 bench_lock_piece_0(Uint64 n) { return bench_lock_piece(n, 0); }
+static Uint64 bench_lock_piece_1(Uint64 n) { return bench_lock_piece(n, 1); }
+static Uint64 bench_lock_piece_2(Uint64 n) { return bench_lock_piece(n, 2); }
+static Uint64 bench_lock_piece_3(Uint64 n) { return bench_lock_piece(n, 3); }
+static Uint64 bench_lock_piece_4(Uint64 n) { return bench_lock_piece(n, 4); }
+
+// Every solution with no time limit and nothing cached, so each search
+// starts from scratch
+static Uint64 bench_pc_solve(Uint64 n, int threads) {
+	Uint64 sum = 0;
+	for(Uint64 i = 0; i < n; i++) {
+		pc_solve(&Openers[i % OPENER_COUNT], threads, 1000000000, NULL, &Solved);
+		sum += Solved.found;
+	}
+	return sum;
+}
+
+static Uint64 bench_pc_solve_opener(Uint64 n) { return bench_pc_solve(n, 1); }
+static Uint64 bench_pc_solve_cores(Uint64 n) { return bench_pc_solve(n, 0); }
+
+static Uint64 bench_fill_random_bag(Uint64 n) {
+	Uint64 sum = 0;
+	Bag b;
+	bag_seed(&b, CORPUS_SEED);
+	for(Uint64 i = 0; i < n; i++) {
+		// Take the pieces straight back out so the buffer never fills
+		b.count = 0;
+		fill_random_bag(&b);
+		sum += b.pieces[(b.head + 6) % BAG_BUFFER];
+	}
+	return sum;
+}
+
+#ifndef BENCH_NO_DRAW
+// One board at full size, and the whole corpus in a grid as big as the
+// game's window gets
+BoardView View;
+BoardView Grid[CORPUS_SIZE];
+#define GRID_MAX_W 1280
+#define GRID_MAX_H 960
+
+// The draw functions only queue quads, these flush the batch as often as a
+// frame would so the time includes the software renderer filling pixels
+static Uint64 bench_draw_piece(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		Piece p = Drops[i % PROBE_COUNT];
+		draw_piece(&View, p, p.x * View.block + STAGE_X(&View),
+			(i % STAGE_H) * View.block + STAGE_Y(&View), i & 1);
+		// Two pieces a frame
+		if(i & 1) graphics_flush_batch();
+	}
+	graphics_flush_batch();
+	return n;
+}
+
+static Uint64 bench_draw_locked(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		draw_locked(&Boards[i % CORPUS_SIZE], &View);
+		graphics_flush_batch();
+	}
+	return n;
+}
+
+static Uint64 bench_draw_stage(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		draw_stage(&Boards[i % CORPUS_SIZE], &View);
+		graphics_flush_batch();
+	}
+	return n;
+}
+
+static Uint64 bench_draw_string(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		graphics_set_color(COLOR_BLACK);
+		graphics_draw_string("Score: 1234567", STAGE_X(&View), 0);
+		graphics_flush_batch();
+	}
+	return n;
+}
+
+static Uint64 bench_draw_chrome(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		draw_chrome(&View);
+		graphics_flush_batch();
+	}
+	return n;
+}
+
+// A whole frame with the layers already drawn, as on most frames
+static Uint64 bench_draw_boards(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		draw_boards(&Boards[0], &View, 1);
+		graphics_flip();
+	}
+	return n;
+}
+
+// Drawing the stage layer again first, as after a piece locks
+static Uint64 bench_draw_boards_changed(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		graphics_invalidate_layer(LAYER_STAGE);
+		draw_boards(&Boards[i % CORPUS_SIZE], &View, 1);
+		graphics_flip();
+	}
+	return n;
+}
+
+// Every board in the corpus at once. With this many some board locks a
+// piece nearly every frame, so the stage layer is drawn again each time
+static Uint64 bench_draw_boards_grid(Uint64 n) {
+	for(Uint64 i = 0; i < n; i++) {
+		graphics_invalidate_layer(LAYER_STAGE);
+		draw_boards(Boards, Grid, CORPUS_SIZE);
+		graphics_flip();
+	}
+	return n;
+}
+#endif
+
+const Bench Benches[] = {
+	{ "validate_piece", bench_validate_piece },
+	{ "wall_kick", bench_wall_kick },
+	{ "ghost_piece", bench_ghost_piece },
+	{ "collide_batch/avx2", bench_collide_avx2, "avx2", "validate_piece" },
+	{ "collide_batch/sse2", bench_collide_sse2, "sse2", "validate_piece" },
+	{ "collide_batch/scalar", bench_collide_scalar, "scalar", "validate_piece" },
+	{ "collide_batch/wide", bench_collide_wide, "wide", "validate_piece" },
+	{ "drop_batch/avx2", bench_drop_avx2, "avx2", "ghost_piece" },
+	{ "drop_batch/sse2", bench_drop_sse2, "sse2", "ghost_piece" },
+	{ "drop_batch/scalar", bench_drop_scalar, "scalar", "ghost_piece" },
+	{ "drop_batch/wide", bench_drop_wide, "wide", "ghost_piece" },
+	{ "copy_state", bench_copy },
+	{ "hard_drop", bench_hard_drop },
+	{ "lock_piece/0", bench_lock_piece_0 },
+	{ "lock_piece/1", bench_lock_piece_1 },
+	{ "lock_piece/2", bench_lock_piece_2 },
+	{ "lock_piece/3", bench_lock_piece_3 },
+	{ "lock_piece/4", bench_lock_piece_4 },
+	{ "fill_random_bag", bench_fill_random_bag },
+	{ "pc_solve/opener", bench_pc_solve_opener },
+	{ "pc_solve/cores", bench_pc_solve_cores },
+#ifndef BENCH_NO_DRAW
+	{ "draw_piece", bench_draw_piece },
+	{ "draw_locked", bench_draw_locked },
+	{ "draw_stage", bench_draw_stage },
+	{ "draw_string", bench_draw_string },
+	{ "draw_chrome", bench_draw_chrome },
+	{ "draw_boards", bench_draw_boards },
+	{ "draw_boards/changed", bench_draw_boards_changed },
+	{ "draw_boards/64", bench_draw_boards_grid },
+#endif
+};
+#define BENCH_COUNT (sizeof(Benches) / sizeof(Benches[0]))
+
+int compare_doubles(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Finds how many operations fill a sample, then times SAMPLES of them
+void run_bench(const Bench *b, BenchResult *result) {
+	Uint64 n = 1, start, elapsed;
+	for(;;) {
+		start = now_ns();
+		sink += b->run(n);
+		elapsed = now_ns() - start;
+		if(elapsed >= SAMPLE_NS / 4) break;
+		n *= 2;
+	}
+	n = n * SAMPLE_NS / elapsed + 1;
+	double samples[SAMPLES], sum = 0;
+	for(int i = 0; i < SAMPLES; i++) {
+		start = now_ns();
+		sink += b->run(n);
+		samples[i] = (double)(now_ns() - start) / n;
+		sum += samples[i];
+	}
+	snprintf(result->name, sizeof(result->name), "%s", b->name);
+	result->mean = sum / SAMPLES;
+	double variance = 0;
+	for(int i = 0; i < SAMPLES; i++) {
+		variance += (samples[i] - result->mean) * (samples[i] - result->mean);
+	}
+	result->stddev = sqrt(variance / (SAMPLES - 1));
+	qsort(samples, SAMPLES, sizeof(double), compare_doubles);
+	result->min = samples[0];
+	result->median = samples[SAMPLES / 2];
+}
+
+// Slower by more than the threshold, and by more than the noise in both
+// runs could explain
+bool regressed(const BenchResult *r, const BenchResult *base, double threshold) {
+	double change = 100 * (r->median - base->median) / base->median;
+	double noise = 2 * sqrt((r->stddev * r->stddev + base->stddev * base->stddev) / SAMPLES);
+	return change > threshold && r->median - base->median > noise;
+}
+
+// Baseline files are a line per benchmark: name, median and stddev in ns
+int load_baseline(const char *filename, BenchResult *base) {
+	FILE *file = fopen(filename, "r");
+	if(!file) return 0;
+	int count = 0;
+	while(count < MAX_BENCHES && fscanf(file, "%31s %lf %lf",
+			base[count].name, &base[count].median, &base[count].stddev) == 3) {
+		count++;
+	}
+	fclose(file);
+	return count;
+}
+
+void save_baseline(const char *filename, BenchResult *results, int count) {
+	FILE *file = fopen(filename, "w");
+	if(!file) {
+		fprintf(stderr, "Could not write %s\n", filename);
+		return;
+	}
+	for(int i = 0; i < count; i++) {
+		fprintf(file, "%s %.3f %.3f\n", results[i].name, results[i].median, results[i].stddev);
+	}
+	fclose(file);
+	printf("Baseline saved to %s\n", filename);
+}
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-f filter] [-s baseline] [-c baseline] [-t percent]\n", name);
+	fprintf(stderr, "  -f  Only run benchmarks with this in their name\n");
+	fprintf(stderr, "  -s  Save the results as a baseline\n");
+	fprintf(stderr, "  -c  Compare against a baseline, exits with 1 if anything got slower\n");
+	fprintf(stderr, "  -t  How much slower counts, default %.0f%%\n", DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char *argv[]) {
+	const char *filter = NULL, *save = NULL, *compare = NULL;
+	double threshold = DEFAULT_THRESHOLD;
+	for(int i = 1; i < argc; i++) {
+		if(i + 1 < argc && strcmp(argv[i], "-f") == 0) filter = argv[++i];
+		else if(i + 1 < argc && strcmp(argv[i], "-s") == 0) save = argv[++i];
+		else if(i + 1 < argc && strcmp(argv[i], "-c") == 0) compare = argv[++i];
+		else if(i + 1 < argc && strcmp(argv[i], "-t") == 0) threshold = atof(argv[++i]);
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	// No log is opened, so the engine's TRACE messages cost a check and
+	// nothing more, as in tetris-sim
+	if(build_corpus() > 0) return 1;
+#ifndef BENCH_NO_DRAW
+	int w, h;
+	draw_layout(&View, 1, StandardStage, GRID_MAX_W, GRID_MAX_H, &w, &h);
+	// The grid takes up more of the screen than one board at full size
+	draw_layout(Grid, CORPUS_SIZE, StandardStage, GRID_MAX_W, GRID_MAX_H, &w, &h);
+	graphics_init_offscreen(w, h);
+	graphics_load_font("data/DejaVuSerif.ttf");
+#endif
+	BenchResult base[MAX_BENCHES], results[MAX_BENCHES];
+	int baseCount = 0, count = 0, regressions = 0;
+	if(compare) {
+		baseCount = load_baseline(compare, base);
+		if(baseCount == 0) printf("No baseline in %s, nothing to compare\n", compare);
+	}
+	printf("%-20s %10s %9s %10s %10s\n", "benchmark", "ns/op", "stddev", "min", "baseline");
+	for(int i = 0; i < BENCH_COUNT; i++) {
+		if(filter && !strstr(Benches[i].name, filter)) continue;
+		if(Benches[i].kernel && !collide_find(Benches[i].kernel)) continue;
+		BenchResult *r = &results[count++];
+		run_bench(&Benches[i], r);
+		printf("%-20s %10.2f %8.1f%% %10.2f", r->name, r->median,
+			100 * r->stddev / r->mean, r->min);
+		for(int j = 0; j < baseCount; j++) {
+			if(strcmp(base[j].name, r->name) != 0) continue;
+			double change = 100 * (r->median - base[j].median) / base[j].median;
+			bool slower = regressed(r, &base[j], threshold);
+			printf(" %+9.1f%%%s", change, slower ? "  REGRESSION" : "");
+			regressions += slower;
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	// Batch kernels against testing the same candidates one at a time
+	for(int i = 0; i < count; i++) {
+		const Bench *b = NULL;
+		for(int j = 0; j < BENCH_COUNT; j++) {
+			if(strcmp(Benches[j].name, results[i].name) == 0) b = &Benches[j];
+		}
+		if(!b->versus) continue;
+		printf("%-20s %7.1f M candidates/s", results[i].name, 1e3 / results[i].median);
+		for(int j = 0; j < count; j++) {
+			if(strcmp(results[j].name, b->versus) != 0) continue;
+			printf(", %.1fx %s", results[j].median / results[i].median, b->versus);
+		}
+		printf("\n");
+	}
+	if(save) save_baseline(save, results, count);
+	if(regressions) printf("%d benchmarks more than %.1f%% slower than the baseline\n",
+		regressions, threshold);
+#ifndef BENCH_NO_DRAW
+	graphics_quit();
+#endif
+	return regressions > 0;
+}
@@ -0,0 +1,215 @@
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "logsys.h"
+
+// Deflate stores at most this many bytes per uncompressed block
+#define STORED_BLOCK 65535
+
+Uint32 CrcTable[256];
+
+static void put_be32(Uint8 *p, Uint32 v) {
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void crc_init() {
+	for(Uint32 i = 0; i < 256; i++) {
+		Uint32 c = i;
+		for(int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		CrcTable[i] = c;
+	}
+}
+
+static Uint32 crc_update(Uint32 crc, const Uint8 *data, size_t size) {
+	for(size_t i = 0; i < size; i++) crc = CrcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+// Rows of filter byte 0 then the pixels, as PNG wants them before deflate
+static size_t png_raw_size(Capture *c) {
+	return (size_t)c->height * (1 + c->width * 4);
+}
+
+// zlib header, stored blocks and the adler32 at the end
+static size_t png_zlib_size(Capture *c) {
+	size_t raw = png_raw_size(c);
+	return 2 + raw + 5 * ((raw + STORED_BLOCK - 1) / STORED_BLOCK) + 4;
+}
+
+static void png_chunk(FILE *file, const char *type, const Uint8 *data, Uint32 size) {
+	Uint8 b[4];
+	put_be32(b, size);
+	fwrite(b, 1, 4, file);
+	fwrite(type, 1, 4, file);
+	fwrite(data, 1, size, file);
+	Uint32 crc = crc_update(0xFFFFFFFF, (const Uint8*)type, 4);
+	put_be32(b, crc_update(crc, data, size) ^ 0xFFFFFFFF);
+	fwrite(b, 1, 4, file);
+}
+
+// Uncompressed PNG, the frames only have to be exact, not small
+static void png_frame(Capture *c, const Uint8 *pixels, int pitch) {
+	char name[256];
+	snprintf(name, sizeof(name), c->filename, (int)c->frames);
+	FILE *file = fopen(name, "wb");
+	if(!file) {
+		log_msgf(ERROR, "Capture: Could not write %s\n", name);
+		return;
+	}
+	Uint8 *out = c->buffer;
+	*out++ = 0x78; *out++ = 0x01;
+	size_t raw = png_raw_size(c), left = raw, row = 0, column = 0;
+	Uint32 a = 1, b = 0;
+	while(left > 0) {
+		size_t size = left < STORED_BLOCK ? left : STORED_BLOCK;
+		left -= size;
+		*out++ = left == 0;
+		*out++ = size; *out++ = size >> 8;
+		*out++ = ~size; *out++ = ~size >> 8;
+		// Filter bytes and pixels, split wherever the block ends
+		for(size_t i = 0; i < size; i++) {
+			Uint8 v = column == 0 ? 0 : pixels[row * pitch + column - 1];
+			if(++column == 1 + (size_t)c->width * 4) { column = 0; row++; }
+			*out++ = v;
+			a = (a + v) % 65521;
+			b = (b + a) % 65521;
+		}
+	}
+	put_be32(out, b << 16 | a);
+	out += 4;
+	const Uint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, 8, file);
+	// 8 bits per channel, RGBA, no interlacing
+	Uint8 header[13] = { 0 };
+	put_be32(header, c->width);
+	put_be32(header + 4, c->height);
+	header[8] = 8;
+	header[9] = 6;
+	png_chunk(file, "IHDR", header, sizeof(header));
+	png_chunk(file, "IDAT", c->buffer, out - c->buffer);
+	png_chunk(file, "IEND", NULL, 0);
+	fclose(file);
+}
+
+// BT.601 studio range, what players assume a y4m without a colorspace is
+static void y4m_frame(Capture *c, const Uint8 *pixels, int pitch) {
+	int w = c->width, h = c->height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+	Uint8 *y = c->buffer, *u = y + w * h, *v = u + cw * ch;
+	for(int j = 0; j < h; j++) {
+		const Uint8 *p = pixels + j * pitch;
+		for(int i = 0; i < w; i++, p += 4) {
+			*y++ = ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16;
+		}
+	}
+	// Chroma from the average of each 2x2 square
+	for(int j = 0; j < ch; j++) {
+		for(int i = 0; i < cw; i++) {
+			int r = 0, g = 0, b = 0, n = 0;
+			for(int dy = 0; dy < 2 && j * 2 + dy < h; dy++) {
+				for(int dx = 0; dx < 2 && i * 2 + dx < w; dx++) {
+					const Uint8 *p = pixels + (j * 2 + dy) * pitch + (i * 2 + dx) * 4;
+					r += p[0]; g += p[1]; b += p[2]; n++;
+				}
+			}
+			r /= n; g /= n; b /= n;
+			*u++ = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+			*v++ = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+		}
+	}
+	fputs("FRAME\n", c->file);
+	fwrite(c->buffer, 1, w * h + cw * ch * 2, c->file);
+}
+
+static bool ends_with(const char *s, const char *end) {
+	size_t a = strlen(s), b = strlen(end);
+	return a >= b && strcmp(s + a - b, end) == 0;
+}
+
+// The name of each PNG is made by handing the filename to snprintf as the
+// format, so it has to have the one %d and nothing else that would read an
+// argument. Flags and a width are fine, "frame%05d.png", and so is %%
+static bool png_pattern_valid(const char *filename) {
+	int numbers = 0;
+	for(const char *p = strchr(filename, '%'); p; p = strchr(p + 1, '%')) {
+		if(p[1] == '%') {
+			p++;
+			continue;
+		}
+		p += strspn(p + 1, "-+ #0") + 1;
+		p += strspn(p, "0123456789");
+		if(*p != 'd') return false;
+		numbers++;
+	}
+	return numbers == 1;
+}
+
+bool capture_open(Capture *c, const char *filename, int width, int height, int rate) {
+	memset(c, 0, sizeof(Capture));
+	c->filename = filename;
+	c->width = width;
+	c->height = height;
+	c->rate = rate;
+	size_t size;
+	if(strchr(filename, '%')) {
+		if(!png_pattern_valid(filename)) {
+			log_msgf(ERROR, "Capture: %s needs exactly one %%d for the frame number\n",
+				filename);
+			return false;
+		}
+		c->format = CAPTURE_PNG;
+		size = png_zlib_size(c);
+		crc_init();
+	} else if(ends_with(filename, ".y4m")) {
+		c->format = CAPTURE_Y4M;
+		size = width * height + ((width + 1) / 2) * ((height + 1) / 2) * 2;
+	} else if(ends_with(filename, ".rgba") || ends_with(filename, ".raw")) {
+		c->format = CAPTURE_RAW;
+		size = width * 4;
+	} else {
+		log_msgf(ERROR, "Capture: Don't know what to write %s as, "
+			"use .rgba, .y4m or a %%d for PNGs\n", filename);
+		return false;
+	}
+	c->buffer = malloc(size);
+	if(!c->buffer) {
+		log_msgf(ERROR, "Capture: Out of memory\n");
+		return false;
+	}
+	if(c->format == CAPTURE_PNG) return true;
+	c->file = fopen(filename, "wb");
+	if(!c->file) {
+		log_msgf(ERROR, "Capture: Could not write %s\n", filename);
+		free(c->buffer);
+		c->buffer = NULL;
+		return false;
+	}
+	if(c->format == CAPTURE_Y4M) {
+		fprintf(c->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, rate);
+	}
+	return true;
+}
+
+void capture_frame(Capture *c, const Uint8 *pixels, int pitch) {
+	if(!c->buffer) return;
+	switch(c->format) {
+		case CAPTURE_RAW:
+		for(int j = 0; j < c->height; j++) fwrite(pixels + j * pitch, 4, c->width, c->file);
+		break;
+		case CAPTURE_Y4M:
+		y4m_frame(c, pixels, pitch);
+		break;
+		case CAPTURE_PNG:
+		png_frame(c, pixels, pitch);
+		break;
+	}
+	c->frames++;
+}
+
+void capture_close(Capture *c) {
+	if(c->file) fclose(c->file);
+	free(c->buffer);
+	log_msgf(INFO, "Capture: %u frames written to %s\n", c->frames, c->filename);
+	memset(c, 0, sizeof(Capture));
+}
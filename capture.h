@@ -0,0 +1,35 @@
+#ifndef TETRIS_CAPTURE
+#define TETRIS_CAPTURE
+
+#include <stdio.h>
+
+#include "types.h"
+
+// What kind of file frames are written to, picked from the filename
+enum {
+	CAPTURE_RAW, // Every frame's RGBA pixels back to back, .rgba or .raw
+	CAPTURE_Y4M, // YUV4MPEG2 video with 4:2:0 chroma, .y4m
+	CAPTURE_PNG  // One PNG per frame, the filename has a %d for the number
+};
+
+// Writes out frames as they're drawn. Needs no SDL, pixels are 4 bytes
+// each in R, G, B, A order
+typedef struct {
+	FILE *file;
+	int format;
+	int width, height, rate;
+	Uint32 frames;
+	const char *filename;
+	// Scratch for one converted frame
+	Uint8 *buffer;
+} Capture;
+
+// Frames are width x height, rate per second is only used by y4m
+bool capture_open(Capture *c, const char *filename, int width, int height, int rate);
+
+// pitch is the bytes from one row of pixels to the next
+void capture_frame(Capture *c, const Uint8 *pixels, int pitch);
+
+void capture_close(Capture *c);
+
+#endif
@@ -0,0 +1,234 @@
+// Load generator for tetris-server. Opens any number of sessions, plays
+// each one with the bot or random keys, and checks every delta against a
+// copy of the game simulated locally from the same seed and input
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "game.h"
+#include "protocol.h"
+#include "search.h"
+
+#define DEFAULT_SOCKET "tetris.sock"
+#define DEFAULT_SESSIONS 100
+#define DEFAULT_FRAMES 3600
+// Frames of input sent ahead of the deltas, no more than the server queues
+#define DEFAULT_WINDOW 32
+#define MAX_WINDOW 64
+#define IN_BUFFER 4096
+#define EPOLL_EVENTS 256
+
+typedef struct {
+	int fd;
+	bool done;
+	// Played ahead as input is sent, for the bot or random keys to look at
+	GameState ahead;
+	BotController bot;
+	Uint32 random;
+	InputBits choice;
+	// Replayed from the deltas the same way the server played it
+	GameState local;
+	SessionView view;
+	InputBits last;
+	// Input sent that the server hasn't stepped yet
+	InputBits pending[MAX_WINDOW];
+	int head, count;
+	Uint32 sent;
+	int inSize;
+	Uint8 in[IN_BUFFER];
+} Client;
+
+Client *clients;
+int window = DEFAULT_WINDOW;
+Uint32 targetFrames = DEFAULT_FRAMES;
+bool useBot = true;
+Uint64 framesChecked, bytesIn, messagesIn, mismatches;
+
+static InputBits next_input(Client *c) {
+	GameState *g = &c->ahead;
+	// Start again after topping out, enter has to go down and up to count
+	if(g->mode == MODE_GAMEOVER) {
+		bot_init(&c->bot, heuristic_weighted, &DefaultWeights);
+		return g->frames & 1 ? INPUT_ENTER : 0;
+	}
+	if(useBot) return bot_input(&c->bot, g);
+	// Same key mashing as tetris-sim's random driver
+	c->choice = random_input(&c->random, c->choice);
+	return c->choice;
+}
+
+// Keeps window frames of input in flight
+static bool send_input(Client *c) {
+	Uint8 message[2 + MAX_WINDOW * 2];
+	int n = 0;
+	while(c->count < window && c->sent < targetFrames) {
+		InputBits bits = next_input(c);
+		game_step(&c->ahead, bits);
+		c->pending[(c->head + c->count++) % MAX_WINDOW] = bits;
+		message[2 + n * 2] = bits;
+		message[3 + n * 2] = bits >> 8;
+		c->sent++;
+		n++;
+	}
+	if(n == 0) return true;
+	message[0] = MSG_INPUT;
+	message[1] = n;
+	// Small enough that a Unix socket takes it whole or not at all
+	return send(c->fd, message, 2 + n * 2, MSG_NOSIGNAL) == 2 + n * 2;
+}
+
+static bool same_view(const SessionView *a, const SessionView *b) {
+	return memcmp(&a->piece, &b->piece, sizeof(Piece)) == 0 &&
+		memcmp(a->rows, b->rows, sizeof(a->rows)) == 0 &&
+		memcmp(a->color, b->color, sizeof(a->color)) == 0 &&
+		memcmp(a->queue, b->queue, sizeof(a->queue)) == 0 &&
+		a->hold == b->hold && a->score == b->score && a->lines == b->lines &&
+		a->level == b->level && a->nextLevel == b->nextLevel &&
+		a->mode == b->mode && a->frames == b->frames;
+}
+
+// Steps the local copy the way the server said it stepped, and checks
+// that the view the deltas built matches it
+static void check_frames(Client *c, int frames, int consumed) {
+	for(int k = 0; k < frames; k++) {
+		if(k < consumed && c->count > 0) {
+			c->last = c->pending[c->head];
+			c->head = (c->head + 1) % MAX_WINDOW;
+			c->count--;
+		}
+		game_step(&c->local, c->last);
+	}
+	SessionView expect;
+	view_update(&expect, &c->local);
+	expect.frames = c->view.frames;
+	if(!same_view(&expect, &c->view)) {
+		if(mismatches++ == 0) {
+			fprintf(stderr, "Session %d differs from the local game at frame %u\n",
+				(int)(c - clients), c->view.frames);
+		}
+	}
+	framesChecked += frames;
+}
+
+// False if the server hung up or sent something that isn't a MSG_FRAME
+static bool read_client(Client *c) {
+	for(;;) {
+		ssize_t n = read(c->fd, c->in + c->inSize, IN_BUFFER - c->inSize);
+		if(n == 0) return false;
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		bytesIn += n;
+		c->inSize += n;
+		int pos = 0;
+		for(;;) {
+			int frames, consumed;
+			int length = delta_decode(&c->view, c->in + pos, c->inSize - pos, &frames, &consumed);
+			if(length < 0) return false;
+			if(length == 0) break;
+			pos += length;
+			messagesIn++;
+			check_frames(c, frames, consumed);
+		}
+		c->inSize -= pos;
+		memmove(c->in, c->in + pos, c->inSize);
+		if(c->view.frames >= targetFrames) {
+			c->done = true;
+			return true;
+		}
+		if(!send_input(c)) return false;
+	}
+}
+
+static bool connect_client(Client *c, const char *path, Uint64 seed) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(c->fd == -1 || connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		perror(path);
+		return false;
+	}
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+	game_seed(&c->ahead, seed);
+	game_seed(&c->local, seed);
+	bot_init(&c->bot, heuristic_weighted, &DefaultWeights);
+	c->random = random_input_seed(seed);
+	Uint8 start[9] = { MSG_START };
+	for(int b = 0; b < 8; b++) start[1 + b] = seed >> (b * 8);
+	if(send(c->fd, start, sizeof(start), MSG_NOSIGNAL) != sizeof(start)) return false;
+	return send_input(c);
+}
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-s socket] [-n sessions] [-f frames] [-w window] "
+		"[-S seed] [-d random|bot]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = DEFAULT_SOCKET;
+	int count = DEFAULT_SESSIONS;
+	Uint64 seed = 1;
+	for(int i = 1; i < argc; i++) {
+		if(i + 1 < argc && strcmp(argv[i], "-s") == 0) path = argv[++i];
+		else if(i + 1 < argc && strcmp(argv[i], "-n") == 0) count = atoi(argv[++i]);
+		else if(i + 1 < argc && strcmp(argv[i], "-f") == 0) targetFrames = atoi(argv[++i]);
+		else if(i + 1 < argc && strcmp(argv[i], "-w") == 0) window = atoi(argv[++i]);
+		else if(i + 1 < argc && strcmp(argv[i], "-S") == 0) seed = strtoull(argv[++i], NULL, 10);
+		else if(i + 1 < argc && strcmp(argv[i], "-d") == 0) useBot = strcmp(argv[++i], "random") != 0;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(count < 1 || window < 1 || window > MAX_WINDOW) {
+		usage(argv[0]);
+		return 1;
+	}
+	clients = calloc(count, sizeof(Client));
+	int epollFd = epoll_create1(0);
+	if(!clients || epollFd == -1) return 1;
+	Uint64 start = now_ns();
+	for(int i = 0; i < count; i++) {
+		if(!connect_client(&clients[i], path, seed + i)) return 1;
+		struct epoll_event event = { .events = EPOLLIN, .data.u32 = i };
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].fd, &event);
+	}
+	int remaining = count, lost = 0;
+	struct epoll_event events[EPOLL_EVENTS];
+	while(remaining > 0) {
+		int n = epoll_wait(epollFd, events, EPOLL_EVENTS, -1);
+		if(n == -1 && errno != EINTR) break;
+		for(int k = 0; k < n; k++) {
+			Client *c = &clients[events[k].data.u32];
+			if(c->done || c->fd == -1) continue;
+			bool ok = read_client(c);
+			if(!ok) lost++;
+			if(!ok || c->done) {
+				close(c->fd);
+				c->fd = -1;
+				remaining--;
+			}
+		}
+	}
+	double seconds = (now_ns() - start) / 1e9;
+	printf("sessions: %d, %d dropped by the server\n", count, lost);
+	printf("frames:   %llu in %.2f s (%.0f frames/s, %.0f sessions at 60 fps)\n",
+		(unsigned long long)framesChecked, seconds, framesChecked / seconds,
+		framesChecked / seconds / 60);
+	printf("deltas:   %llu, %.2f bytes per frame\n", (unsigned long long)messagesIn,
+		framesChecked ? (double)bytesIn / framesChecked : 0);
+	printf("checked:  %llu mismatches\n", (unsigned long long)mismatches);
+	free(clients);
+	return mismatches > 0 || lost > 0;
+}
@@ -0,0 +1,10 @@
+#ifndef TETRIS_CLOCK
+#define TETRIS_CLOCK
+
+#include "types.h"
+
+// Nanoseconds on the monotonic clock, for timing anything that runs
+// without SDL. Only the difference between two readings means anything
+Uint64 now_ns();
+
+#endif
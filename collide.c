@@ -0,0 +1,340 @@
+#include "collide.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+// The SIMD kernels are built for x86 whatever the compiler flags say, and
+// only run if the CPU turns out to have the instructions
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLLIDE_X86
+#include <immintrin.h>
+#endif
+
+// A piece's 4 grid rows and 4 stage rows are both read as one word on
+// narrow stages, and in 16 bit lanes a stage row has to fit the same way.
+// Wide stages get 32 bit rows, a shape shifted as far over as it goes
+// stays inside them
+_Static_assert(sizeof(Row) == 2, "collide reads rows as 16 bit lanes");
+_Static_assert(COLLIDE_NARROW >= STAGE_W, "standard stage too wide for the narrow kernels");
+_Static_assert(COLLIDE_LEFT + MAX_STAGE_W + 3 <= 32, "stage too wide for the wide kernel");
+
+void collide_board(CollideBoard *b, const Stage *s) {
+	int bottom = COLLIDE_TOP + s->size.height;
+	Uint32 walls = ~((Uint32)s->full << COLLIDE_LEFT);
+	b->width = s->size.width;
+	b->height = s->size.height;
+	b->kernel = collide_kernel(b->width);
+	if(b->width <= COLLIDE_NARROW) {
+		for(int y = 0; y < COLLIDE_TOP; y++) b->rows[y] = walls;
+		for(int y = 0; y < s->size.height; y++) {
+			b->rows[COLLIDE_TOP + y] = walls | s->rows[y] << COLLIDE_LEFT;
+		}
+		for(int y = 0; y < COLLIDE_FLOOR; y++) b->rows[bottom + y] = 0xFFFF;
+	} else {
+		for(int y = 0; y < COLLIDE_TOP; y++) b->wide[y] = walls;
+		for(int y = 0; y < s->size.height; y++) {
+			b->wide[COLLIDE_TOP + y] = walls | (Uint32)s->rows[y] << COLLIDE_LEFT;
+		}
+		for(int y = 0; y < COLLIDE_FLOOR; y++) b->wide[bottom + y] = 0xFFFFFFFF;
+	}
+	memset(b->surface, 0, sizeof(b->surface));
+	memcpy(b->surface + COLLIDE_LEFT, s->surface, b->width);
+}
+
+static inline Uint64 board_rows(const CollideBoard *b, int row) {
+	Uint64 rows;
+	memcpy(&rows, &b->rows[row], sizeof(rows));
+	return rows;
+}
+
+static inline Uint64 shape_rows(Piece p) {
+	Uint64 rows;
+	memcpy(&rows, PieceShapes[p.type][p.flip].rows, sizeof(rows));
+	return rows;
+}
+
+// Padded row the candidate's grid starts on, and how far its shape shifts
+// over. Rows above the stage are all the same so higher pieces can use
+// the top one, and anything off the sides is pointed at the floor
+static inline int place(const CollideBoard *b, Piece p, int *shift) {
+	if(p.x < -COLLIDE_LEFT || p.x >= b->width) {
+		*shift = 0;
+		return COLLIDE_TOP + b->height;
+	}
+	*shift = p.x + COLLIDE_LEFT;
+	int y = p.y < -COLLIDE_TOP ? -COLLIDE_TOP : p.y > b->height ? b->height : p.y;
+	return y + COLLIDE_TOP;
+}
+
+// Whether the shape overlaps 4 wide rows from row on, one row at a time
+static inline bool overlaps_wide(const CollideBoard *b, Piece p, int row, int shift) {
+	const Row *shape = PieceShapes[p.type][p.flip].rows;
+	Uint32 overlap = 0;
+	for(int j = 0; j < 4; j++) overlap |= (Uint32)shape[j] << shift & b->wide[row + j];
+	return overlap != 0;
+}
+
+// For pieces tucked under an overhang, where the surface says nothing
+static int step_down(const CollideBoard *b, Piece p) {
+	int shift, row = place(b, p, &shift);
+	int distance = 0;
+	if(b->width > COLLIDE_NARROW) {
+		while(!overlaps_wide(b, p, row + distance + 1, shift)) distance++;
+		return distance;
+	}
+	Uint64 shape = shape_rows(p) << shift;
+	while(!(shape & board_rows(b, row + distance + 1))) distance++;
+	return distance;
+}
+
+static Uint64 collide_scalar(const CollideBoard *b, const Piece *p, int count) {
+	Uint64 hits = 0;
+	for(int i = 0; i < count; i++) {
+		int shift, row = place(b, p[i], &shift);
+		hits |= (Uint64)((shape_rows(p[i]) << shift & board_rows(b, row)) != 0) << i;
+	}
+	return hits;
+}
+
+// Any width, for the stages too wide for the others
+static Uint64 collide_wide(const CollideBoard *b, const Piece *p, int count) {
+	Uint64 hits = 0;
+	for(int i = 0; i < count; i++) {
+		int shift, row = place(b, p[i], &shift);
+		hits |= (Uint64)overlaps_wide(b, p[i], row, shift) << i;
+	}
+	return hits;
+}
+
+// Same as drop_distance, but against the padded surface. Works for any
+// width, the surface is laid out the same
+static void drop_scalar(const CollideBoard *b, const Piece *p, int count, Uint8 *out) {
+	for(int k = 0; k < count; k++) {
+		const PieceShape *s = &PieceShapes[p[k].type][p[k].flip];
+		int distance = b->height;
+		for(int i = s->minX; i <= s->maxX; i++) {
+			int gap = b->surface[p[k].x + COLLIDE_LEFT + i] - (p[k].y + s->bottom[i]) - 1;
+			if(gap < 0) {
+				distance = step_down(b, p[k]);
+				break;
+			}
+			if(gap < distance) distance = gap;
+		}
+		out[k] = distance;
+	}
+}
+
+#ifdef COLLIDE_X86
+
+// 1 << shift in each 16 bit lane of a word, SSE2 can't shift lanes by
+// different amounts so shapes are multiplied instead
+#define POW2_LANES(s) (0x0001000100010001ull << (s))
+static const Uint64 Pow2Lanes[16] = {
+	POW2_LANES(0), POW2_LANES(1), POW2_LANES(2), POW2_LANES(3),
+	POW2_LANES(4), POW2_LANES(5), POW2_LANES(6), POW2_LANES(7),
+	POW2_LANES(8), POW2_LANES(9), POW2_LANES(10), POW2_LANES(11),
+	POW2_LANES(12), POW2_LANES(13), POW2_LANES(14), POW2_LANES(15)
+};
+
+// Decodes 4 candidates a vector, then tests them 2 a vector as 4 rows of
+// 16 bits each
+__attribute__((target("sse2")))
+static Uint64 collide_sse2(const CollideBoard *b, const Piece *p, int count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i right = _mm_set1_epi32(b->width - 1), height = _mm_set1_epi32(b->height);
+	const __m128i floor = _mm_set1_epi32(COLLIDE_TOP + b->height);
+	const PieceShape *shapes = &PieceShapes[0][0];
+	Uint64 hits = 0;
+	int i = 0;
+	for(; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		__m128i x = _mm_srai_epi32(_mm_slli_epi32(v, 24), 24);
+		__m128i y = _mm_srai_epi32(_mm_slli_epi32(v, 16), 24);
+		__m128i off = _mm_or_si128(_mm_cmpgt_epi32(_mm_set1_epi32(-COLLIDE_LEFT), x),
+			_mm_cmpgt_epi32(x, right));
+		// Clamped the same way as place, with compares and masks for min and max
+		__m128i low = _mm_cmpgt_epi32(_mm_set1_epi32(-COLLIDE_TOP), y);
+		y = _mm_or_si128(_mm_and_si128(low, _mm_set1_epi32(-COLLIDE_TOP)), _mm_andnot_si128(low, y));
+		__m128i high = _mm_cmpgt_epi32(y, height);
+		y = _mm_or_si128(_mm_and_si128(high, height), _mm_andnot_si128(high, y));
+		__m128i row = _mm_or_si128(_mm_and_si128(off, floor),
+			_mm_andnot_si128(off, _mm_add_epi32(y, _mm_set1_epi32(COLLIDE_TOP))));
+		__m128i shift = _mm_andnot_si128(off, _mm_add_epi32(x, _mm_set1_epi32(COLLIDE_LEFT)));
+		__m128i shape = _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 16),
+			_mm_set1_epi32(0xFF)), 2), _mm_srli_epi32(v, 24));
+		int rows[4], shifts[4], types[4];
+		_mm_storeu_si128((__m128i*)rows, row);
+		_mm_storeu_si128((__m128i*)shifts, shift);
+		_mm_storeu_si128((__m128i*)types, shape);
+		for(int k = 0; k < 4; k += 2) {
+			__m128i bits = _mm_unpacklo_epi64(
+				_mm_loadl_epi64((const __m128i*)shapes[types[k]].rows),
+				_mm_loadl_epi64((const __m128i*)shapes[types[k + 1]].rows));
+			__m128i scale = _mm_unpacklo_epi64(
+				_mm_loadl_epi64((const __m128i*)&Pow2Lanes[shifts[k]]),
+				_mm_loadl_epi64((const __m128i*)&Pow2Lanes[shifts[k + 1]]));
+			__m128i stage = _mm_unpacklo_epi64(
+				_mm_loadl_epi64((const __m128i*)&b->rows[rows[k]]),
+				_mm_loadl_epi64((const __m128i*)&b->rows[rows[k + 1]]));
+			__m128i overlap = _mm_and_si128(_mm_mullo_epi16(bits, scale), stage);
+			int clear = _mm_movemask_epi8(_mm_cmpeq_epi16(overlap, zero));
+			hits |= (Uint64)(((clear & 0xFF) != 0xFF) | (clear >> 8 != 0xFF) << 1) << (i + k);
+		}
+	}
+	if(i < count) hits |= collide_scalar(b, p + i, count - i) << i;
+	return hits;
+}
+
+// One candidate a vector, the gap under each of its 4 columns in a 16 bit
+// lane, then the smallest of them
+__attribute__((target("sse2")))
+static void drop_sse2(const CollideBoard *b, const Piece *p, int count, Uint8 *out) {
+	const __m128i zero = _mm_setzero_si128(), none = _mm_set1_epi16(-1);
+	const __m128i far = _mm_set1_epi16(b->height);
+	for(int i = 0; i < count; i++) {
+		Uint32 surface, bottom;
+		memcpy(&surface, b->surface + p[i].x + COLLIDE_LEFT, 4);
+		memcpy(&bottom, PieceShapes[p[i].type][p[i].flip].bottom, 4);
+		__m128i s = _mm_unpacklo_epi8(_mm_cvtsi32_si128(surface), zero);
+		__m128i bt = _mm_srai_epi16(_mm_unpacklo_epi8(zero, _mm_cvtsi32_si128(bottom)), 8);
+		__m128i gap = _mm_sub_epi16(_mm_sub_epi16(s, bt), _mm_set1_epi16(p[i].y + 1));
+		// Columns the piece has no block in can't stop it
+		__m128i empty = _mm_cmpeq_epi16(bt, none);
+		gap = _mm_or_si128(_mm_and_si128(empty, far), _mm_andnot_si128(empty, gap));
+		gap = _mm_min_epi16(gap, far);
+		gap = _mm_min_epi16(gap, _mm_shufflelo_epi16(gap, _MM_SHUFFLE(2, 3, 0, 1)));
+		gap = _mm_min_epi16(gap, _mm_shufflelo_epi16(gap, _MM_SHUFFLE(1, 0, 3, 2)));
+		int distance = (short)_mm_cvtsi128_si32(gap);
+		out[i] = distance < 0 ? step_down(b, p[i]) : distance;
+	}
+}
+
+// Splits 8 pieces into 32 bit lanes of x, y and byte offset into PieceShapes
+#define UNPACK_PIECES(v, x, y, shape) \
+	__m256i x = _mm256_srai_epi32(_mm256_slli_epi32(v, 24), 24); \
+	__m256i y = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 24); \
+	__m256i shape = _mm256_mullo_epi32(_mm256_set1_epi32(sizeof(PieceShape)), \
+		_mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 16), \
+		_mm256_set1_epi32(0xFF)), 2), _mm256_srli_epi32(v, 24)))
+
+// Eight candidates an iteration. Each one's shape and stage rows are
+// gathered as 64 bit words and shifted with a per lane shift
+__attribute__((target("avx2")))
+static Uint64 collide_avx2(const CollideBoard *b, const Piece *p, int count) {
+	_Static_assert(sizeof(Piece) == 4, "collide_avx2 loads pieces as 32 bit lanes");
+	const long long *shapes = (const long long*)((const char*)PieceShapes + offsetof(PieceShape, rows));
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i right = _mm256_set1_epi32(b->width - 1), height = _mm256_set1_epi32(b->height);
+	const __m256i floor = _mm256_set1_epi32(COLLIDE_TOP + b->height);
+	Uint64 hits = 0;
+	int i = 0;
+	for(; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+		UNPACK_PIECES(v, x, y, shape);
+		__m256i off = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(-COLLIDE_LEFT), x),
+			_mm256_cmpgt_epi32(x, right));
+		y = _mm256_min_epi32(_mm256_max_epi32(y, _mm256_set1_epi32(-COLLIDE_TOP)), height);
+		__m256i row = _mm256_blendv_epi8(_mm256_add_epi32(y, _mm256_set1_epi32(COLLIDE_TOP)),
+			floor, off);
+		__m256i shift = _mm256_andnot_si256(off, _mm256_add_epi32(x, _mm256_set1_epi32(COLLIDE_LEFT)));
+		int clear = 0;
+		for(int h = 0; h < 2; h++) {
+			__m128i shapeHalf = h ? _mm256_extracti128_si256(shape, 1) : _mm256_castsi256_si128(shape);
+			__m128i rowHalf = h ? _mm256_extracti128_si256(row, 1) : _mm256_castsi256_si128(row);
+			__m128i shiftHalf = h ? _mm256_extracti128_si256(shift, 1) : _mm256_castsi256_si128(shift);
+			__m256i bits = _mm256_sllv_epi64(_mm256_i32gather_epi64(shapes, shapeHalf, 1),
+				_mm256_cvtepu32_epi64(shiftHalf));
+			__m256i stage = _mm256_i32gather_epi64((const long long*)b->rows, rowHalf, 2);
+			__m256i fits = _mm256_cmpeq_epi64(_mm256_and_si256(bits, stage), zero);
+			clear |= _mm256_movemask_pd(_mm256_castsi256_pd(fits)) << (4 * h);
+		}
+		hits |= (Uint64)(~clear & 0xFF) << i;
+	}
+	if(i < count) hits |= collide_scalar(b, p + i, count - i) << i;
+	return hits;
+}
+
+// Eight candidates an iteration, gathering the 4 surface bytes under each
+// one and its 4 column bottoms as one 32 bit lane each
+__attribute__((target("avx2")))
+static void drop_avx2(const CollideBoard *b, const Piece *p, int count, Uint8 *out) {
+	const int *bottoms = (const int*)((const char*)PieceShapes + offsetof(PieceShape, bottom));
+	const __m256i none = _mm256_set1_epi32(-1), far = _mm256_set1_epi32(b->height);
+	const __m256i byte = _mm256_set1_epi32(0xFF), zero = _mm256_setzero_si256();
+	int i = 0;
+	for(; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+		UNPACK_PIECES(v, x, y, shape);
+		__m256i surface = _mm256_i32gather_epi32((const int*)b->surface,
+			_mm256_add_epi32(x, _mm256_set1_epi32(COLLIDE_LEFT)), 1);
+		__m256i bottom = _mm256_i32gather_epi32(bottoms, shape, 1);
+		__m256i top = _mm256_add_epi32(y, _mm256_set1_epi32(1));
+		__m256i distance = far, tucked = zero;
+		for(int c = 0; c < 4; c++) {
+			__m256i s = _mm256_and_si256(_mm256_srli_epi32(surface, 8 * c), byte);
+			__m256i bt = _mm256_srai_epi32(_mm256_slli_epi32(bottom, 24 - 8 * c), 24);
+			__m256i gap = _mm256_sub_epi32(_mm256_sub_epi32(s, bt), top);
+			__m256i empty = _mm256_cmpeq_epi32(bt, none);
+			tucked = _mm256_or_si256(tucked, _mm256_andnot_si256(empty, _mm256_cmpgt_epi32(zero, gap)));
+			distance = _mm256_min_epi32(distance, _mm256_blendv_epi8(gap, far, empty));
+		}
+		int slow = _mm256_movemask_ps(_mm256_castsi256_ps(tucked));
+		// Pack the 8 distances down to bytes
+		__m256i packed = _mm256_packs_epi32(distance, distance);
+		packed = _mm256_packus_epi16(packed, packed);
+		Uint32 lo = _mm256_extract_epi32(packed, 0), hi = _mm256_extract_epi32(packed, 4);
+		memcpy(out + i, &lo, 4);
+		memcpy(out + i + 4, &hi, 4);
+		while(slow) {
+			int k = __builtin_ctz(slow);
+			out[i + k] = step_down(b, p[i + k]);
+			slow &= slow - 1;
+		}
+	}
+	if(i < count) drop_scalar(b, p + i, count - i, out + i);
+}
+
+static bool has_avx2() { return __builtin_cpu_supports("avx2") != 0; }
+static bool has_sse2() { return __builtin_cpu_supports("sse2") != 0; }
+
+#endif
+
+static bool always() { return true; }
+
+const CollideKernel CollideKernels[] = {
+#ifdef COLLIDE_X86
+	{ "avx2", COLLIDE_NARROW, has_avx2, collide_avx2, drop_avx2 },
+	{ "sse2", COLLIDE_NARROW, has_sse2, collide_sse2, drop_sse2 },
+#endif
+	{ "scalar", COLLIDE_NARROW, always, collide_scalar, drop_scalar },
+	{ "wide", MAX_STAGE_W, always, collide_wide, drop_scalar },
+};
+const int CollideKernelCount = sizeof(CollideKernels) / sizeof(CollideKernels[0]);
+
+const CollideKernel *collide_kernel(int width) {
+	static const CollideKernel *_Atomic chosen[MAX_STAGE_W + 1];
+	const CollideKernel *k = atomic_load_explicit(&chosen[width], memory_order_relaxed);
+	if(k) return k;
+	// Every thread that gets here picks the same one
+	k = &CollideKernels[0];
+	while(k->maxWidth < width || !k->supported()) k++;
+	atomic_store_explicit(&chosen[width], k, memory_order_relaxed);
+	return k;
+}
+
+const CollideKernel *collide_find(const char *name) {
+	for(int i = 0; i < CollideKernelCount; i++) {
+		const CollideKernel *k = &CollideKernels[i];
+		if(strcmp(k->name, name) == 0) return k->supported() ? k : NULL;
+	}
+	return NULL;
+}
+
+Uint64 collide_batch(const CollideBoard *b, const Piece *p, int count) {
+	return b->kernel->collide(b, p, count);
+}
+
+void drop_batch(const CollideBoard *b, const Piece *p, int count, Uint8 *out) {
+	b->kernel->drop(b, p, count, out);
+}
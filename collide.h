@@ -0,0 +1,74 @@
+#ifndef TETRIS_COLLIDE
+#define TETRIS_COLLIDE
+
+#include "game.h"
+
+// Batched versions of validate_piece and drop_distance, for code that
+// tests many candidate positions against the same stage at once. The
+// kernel is picked at runtime from what the CPU supports and how wide the
+// stage is
+
+// Most candidates one collide_batch call takes
+#define COLLIDE_BATCH 64
+// Columns of wall left of the stage, and rows above and below it, so any
+// position a piece can hang off the stage stays inside the padded rows
+#define COLLIDE_LEFT 3
+#define COLLIDE_TOP 4
+#define COLLIDE_FLOOR 4
+// Widest stage whose padded rows fit in 16 bits, which covers the standard
+// one. Wider stages get 32 bits a row and a kernel that works a row at a time
+#define COLLIDE_NARROW (16 - COLLIDE_LEFT - 3)
+
+typedef struct CollideKernel CollideKernel;
+
+// The stage laid out for the kernels. On narrow stages four rows in a row
+// can be read as one 64 bit word, and a piece's rows shifted over to its x
+// are tested against them with one AND
+typedef struct {
+	// Stage rows shifted over COLLIDE_LEFT columns with the walls filled
+	// in, rows above the stage have only walls and the floor is full.
+	// rows for stages up to COLLIDE_NARROW wide, wide for the rest
+	union {
+		Uint16 rows[COLLIDE_TOP + MAX_STAGE_H + COLLIDE_FLOOR];
+		Uint32 wide[COLLIDE_TOP + MAX_STAGE_H + COLLIDE_FLOOR];
+	};
+	// Stage surface shifted the same way, with room to read 4 columns
+	// from any x a piece can be at
+	Uint8 surface[COLLIDE_LEFT + MAX_STAGE_W + 3];
+	int width, height;
+	// What collide_batch and drop_batch run, picked for the width
+	const CollideKernel *kernel;
+} CollideBoard;
+
+struct CollideKernel {
+	const char *name;
+	// Widest stage the kernel's board layout holds
+	int maxWidth;
+	bool (*supported)();
+	Uint64 (*collide)(const CollideBoard *b, const Piece *p, int count);
+	void (*drop)(const CollideBoard *b, const Piece *p, int count, Uint8 *out);
+};
+
+// Every kernel built in, fastest first. The narrow ones end with one in
+// plain C, and the last one is plain C for any width. Both are always
+// supported
+extern const CollideKernel CollideKernels[];
+extern const int CollideKernelCount;
+
+void collide_board(CollideBoard *b, const Stage *s);
+
+// Fastest kernel this CPU supports for stages width columns wide
+const CollideKernel *collide_kernel(int width);
+
+// Kernel by name if it is built in and supported, otherwise NULL
+const CollideKernel *collide_find(const char *name);
+
+// Bit i is set when p[i] doesn't fit, the same answer as !validate_piece
+// for each. At most COLLIDE_BATCH candidates
+Uint64 collide_batch(const CollideBoard *b, const Piece *p, int count);
+
+// Rows each candidate can fall, the same as drop_distance. Every candidate
+// has to fit. Any number of candidates
+void drop_batch(const CollideBoard *b, const Piece *p, int count, Uint8 *out);
+
+#endif
@@ -0,0 +1,202 @@
+#include "draw.h"
+
+#include "graphics.h"
+#include "profile.h"
+
+Uint32 PieceColor[8] = {
+	COLOR_YELLOW, // O - Yellow
+	COLOR_CYAN,   // I - Cyan
+	COLOR_BLUE,   // J - Blue
+	COLOR_ORANGE, // L - Orange
+	COLOR_GREEN,  // S - Green
+	COLOR_RED,    // Z - Red
+	COLOR_PURPLE, // T - Purple
+	COLOR_SHADOW  // Shadow
+};
+
+// Gap left around each block so they don't run together
+#define BLOCK_GAP(v) ((v)->block >= 4 ? 1 : 0)
+
+void draw_layout(BoardView *views, int count, StageSize size, int maxW, int maxH,
+		int *w, int *h) {
+	int columns = 1;
+	while(columns * columns < count) columns++;
+	int rows = (count + columns - 1) / columns;
+	int boardW = BOARD_W(size), boardH = BOARD_H(size);
+	int block = BLOCK_SIZE;
+	while(block > 1 && (columns * boardW * block > maxW || rows * boardH * block > maxH)) block--;
+	for(int i = 0; i < count; i++) {
+		views[i] = (BoardView){
+			(i % columns) * boardW * block, (i / columns) * boardH * block,
+			block, size, block == BLOCK_SIZE, 0
+		};
+	}
+	*w = columns * boardW * block;
+	*h = rows * boardH * block;
+}
+
+void draw_boards(GameState *games, BoardView *views, int count) {
+	// Backgrounds and labels never change, they are drawn once and kept
+	if(graphics_begin_layer(LAYER_CHROME)) {
+		for(int i = 0; i < count; i++) draw_chrome(&views[i]);
+		graphics_end_layer();
+	}
+	graphics_draw_layer(LAYER_CHROME);
+	// Locked blocks, queue and hold only change when a piece locks or is
+	// held. Every board shares the layer, so any of them changing draws
+	// all of them again
+	for(int i = 0; i < count; i++) {
+		if(games[i].stageChanges != views[i].stageDrawn) graphics_invalidate_layer(LAYER_STAGE);
+	}
+	if(graphics_begin_layer(LAYER_STAGE)) {
+		for(int i = 0; i < count; i++) {
+			draw_locked(&games[i], &views[i]);
+			views[i].stageDrawn = games[i].stageChanges;
+		}
+		graphics_end_layer();
+	}
+	graphics_draw_layer(LAYER_STAGE);
+	for(int i = 0; i < count; i++) {
+		// Game mode specific draw functions
+		switch(games[i].mode) {
+			case MODE_STAGE:
+			draw_stage(&games[i], &views[i]);
+			break;
+			case MODE_GAMEOVER:
+			draw_game_over(&views[i]);
+			break;
+		}
+		if(views[i].text) draw_numbers(&games[i], &views[i]);
+	}
+}
+
+void draw_chrome(const BoardView *v) {
+	int block = v->block;
+	graphics_set_color(COLOR_BLACK);
+	// Draw stage background
+	graphics_draw_rect(STAGE_X(v), STAGE_Y(v), v->size.width * block, SHOWN_H(v->size) * block);
+	// Queue background
+	graphics_draw_rect(QUEUE_X(v), QUEUE_Y(v), block * 4, block * 4 * 5);
+	// Hold background
+	graphics_draw_rect(HOLD_X(v), HOLD_Y(v), block * 4, block * 4);
+	if(!v->text) return;
+	// Draw the text
+	graphics_draw_string("Score: ", STAGE_X(v), v->y);
+	graphics_draw_string("Queue", QUEUE_X(v), v->y);
+	graphics_draw_string("Hold", HOLD_X(v), v->y);
+	graphics_draw_string("Level:", HOLD_X(v), HOLD_Y(v) + (5 * block));
+	graphics_draw_string("Next:",  HOLD_X(v), HOLD_Y(v) + (10 * block));
+	graphics_draw_string("Total:", HOLD_X(v), HOLD_Y(v) + (15 * block));
+}
+
+void draw_piece(const BoardView *v, Piece p, int x, int y, bool shadow) {
+	// 7 is the shadow color, others match with Piece.type
+	Uint32 color = PieceColor[shadow ? 7 : p.type];
+	const PieceShape *s = &PieceShapes[p.type][p.flip];
+	int block = v->block, gap = BLOCK_GAP(v);
+	for(int i = 0; i < 4; i++) {
+		int bx = s->cells[i].x, by = s->cells[i].y;
+		if(p.y + by < 0) continue;
+		graphics_draw_block(x + bx * block + gap, y + by * block + gap,
+			block - gap * 2, block - gap * 2, color);
+	}
+}
+
+// Smaller than the locked blocks so they show through, each in the color
+// of its piece
+void draw_hint(const BoardView *v, const PcSolution *s) {
+	int block = v->block, inset = block / 4;
+	for(int i = 0; i < s->count; i++) {
+		Uint32 color = PieceColor[s->steps[i].piece.type];
+		for(int c = 0; c < 4; c++) {
+			int y = s->steps[i].cells[c].y - v->size.hidden;
+			if(y < 0) continue;
+			graphics_draw_block(s->steps[i].cells[c].x * block + STAGE_X(v) + inset,
+				y * block + STAGE_Y(v) + inset, block - inset * 2, block - inset * 2, color);
+		}
+	}
+}
+
+void draw_stage(GameState *g, const BoardView *v) {
+	int block = v->block;
+	// Under the ghost and the falling piece, which may be on top of it
+	const PcResult *hint = v->hint;
+	if(hint && hint->count && hint->stageChanges == g->stageChanges) {
+		draw_hint(v, &hint->solutions[0]);
+	}
+	// Rows counted from the top shown one, so draw_piece leaves out the
+	// blocks in the hidden rows
+	Piece shadow = game_ghost(g), piece = g->piece;
+	shadow.y -= v->size.hidden;
+	piece.y -= v->size.hidden;
+	// Draw the ghost piece (shadow)
+	draw_piece(v, shadow, shadow.x * block + STAGE_X(v), shadow.y * block + STAGE_Y(v), true);
+	// Draw current piece
+	draw_piece(v, piece, piece.x * block + STAGE_X(v), piece.y * block + STAGE_Y(v), false);
+}
+
+void draw_locked(const GameState *g, const BoardView *v) {
+	int block = v->block, gap = BLOCK_GAP(v);
+	// Draw the pieces on the shown part of the stage
+	for (int j = v->size.hidden; j < v->size.height; j++) {
+		Row row = g->stage.rows[j];
+		int y = (j - v->size.hidden) * block + STAGE_Y(v) + gap;
+		// Walk only the filled bits of each row, empty rows cost nothing
+		for (int i = 0; row; i++, row >>= 1) {
+			if (!(row & 1)) continue;
+			int c = g->stage.color[j][i] - 1;
+			graphics_draw_block(i * block + STAGE_X(v) + gap, y,
+				block - gap * 2, block - gap * 2, PieceColor[c]);
+		}
+	}
+	// Queue pieces
+	for(int q = 0; q < 5; q++) {
+		draw_piece(v, g->queue[q], QUEUE_X(v), q * (block*4) + QUEUE_Y(v), false);
+	}
+	// Hold piece
+	if(g->heldSomething) {
+		draw_piece(v, g->hold, HOLD_X(v), HOLD_Y(v), false);
+	}
+}
+
+void draw_numbers(const GameState *g, const BoardView *v) {
+	int block = v->block;
+	graphics_set_color(COLOR_BLACK);
+	graphics_draw_int(g->score, STAGE_X(v) + graphics_string_width("Score: ") + 6 * block, v->y);
+	graphics_draw_int(g->level,       HOLD_X(v) + 4 * block, HOLD_Y(v) + (7 * block));
+	graphics_draw_int(g->nextLevel,   HOLD_X(v) + 4 * block, HOLD_Y(v) + (12 * block));
+	graphics_draw_int(g->totalLines,  HOLD_X(v) + 4 * block, HOLD_Y(v) + (17 * block));
+}
+
+void draw_game_over(const BoardView *v) {
+	graphics_set_color(COLOR_RED);
+	if(v->text) {
+		graphics_draw_string("Game Over", STAGE_X(v), STAGE_Y(v) + 5*v->block);
+	} else {
+		// Too small to read, a red bar across the stage instead
+		graphics_draw_rect(STAGE_X(v), STAGE_Y(v) + 5*v->block, v->size.width * v->block, v->block);
+	}
+}
+
+// Percentiles of every timed phase in microseconds, over the bottom of the screen
+void draw_times(int w, int h) {
+	const double percentiles[] = { 0.5, 0.99, 0.999, 1.0 };
+	int y = h - (PHASE_COUNT + 1) * TIMES_LINE;
+	graphics_set_color(COLOR_BLACK);
+	graphics_draw_rect(0, y, w, (PHASE_COUNT + 1) * TIMES_LINE);
+	graphics_set_color(COLOR_WHITE);
+	graphics_draw_string("us", 4, y);
+	graphics_draw_string("p50", w - 4 * TIMES_COLUMN, y);
+	graphics_draw_string("p99", w - 3 * TIMES_COLUMN, y);
+	graphics_draw_string("p99.9", w - 2 * TIMES_COLUMN, y);
+	graphics_draw_string("max", w - TIMES_COLUMN, y);
+	for(int i = 0; i < PHASE_COUNT; i++) {
+		y += TIMES_LINE;
+		graphics_draw_string((char*)PhaseNames[i], 4, y);
+		for(int j = 0; j < 4; j++) {
+			// Right aligned under the end of each heading's column
+			graphics_draw_int(histogram_percentile(&PhaseTimes[i], percentiles[j]),
+				w - (3 - j) * TIMES_COLUMN - 8, y);
+		}
+	}
+}
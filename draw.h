@@ -0,0 +1,81 @@
+#ifndef TETRIS_DRAW
+#define TETRIS_DRAW
+
+#include "game.h"
+#include "perfect.h"
+
+// Size for each individual block at full size, boards in a big grid are
+// drawn with smaller ones
+#define BLOCK_SIZE 16
+// Rows of a stage a board shows, the hidden ones at the top are left out
+#define SHOWN_H(s) ((s).height - (s).hidden)
+// Area one board takes up in blocks, the stage with the hold and
+// numbers to its left and the queue to its right. Those need 20 rows
+// next to the stage however short it is
+#define BOARD_W(s) ((s).width + 12)
+#define BOARD_H(s) ((SHOWN_H(s) > 20 ? SHOWN_H(s) : 20) + 4)
+// Line height and column width of the frame timing overlay
+#define TIMES_LINE 20
+#define TIMES_COLUMN 56
+
+// Where and how big one board is drawn. Everything in it is placed in
+// blocks from its top left corner, so any number of them fit on screen
+typedef struct {
+	int x, y, block;
+	// Size of the stage the board's game is played on
+	StageSize size;
+	// Text only comes in one size, so labels and numbers are only drawn
+	// on boards at full size
+	bool text;
+	// stageChanges of the board's game when its stage layer was drawn
+	Uint32 stageDrawn;
+	// Perfect clears to show a hint of, NULL for none. Only drawn while
+	// they are for the game as it is
+	const PcResult *hint;
+} BoardView;
+
+// Locations inside a board, in pixels
+#define STAGE_X(v) ((v)->x + 6 * (v)->block)
+#define STAGE_Y(v) ((v)->y + 2 * (v)->block)
+#define QUEUE_X(v) ((v)->x + ((v)->size.width + 7) * (v)->block)
+#define QUEUE_Y(v) ((v)->y + 2 * (v)->block)
+#define HOLD_X(v) ((v)->x + 1 * (v)->block)
+#define HOLD_Y(v) ((v)->y + 2 * (v)->block)
+
+// Fill color of each piece type, and the ghost piece last
+extern Uint32 PieceColor[8];
+
+// Arranges count boards of games on stages this size in a grid as square as
+// it can be, with the biggest blocks that fit it in maxW x maxH. The size it
+// ended up is put in w, h
+void draw_layout(BoardView *views, int count, StageSize size, int maxW, int maxH,
+	int *w, int *h);
+
+// Everything the boards show, games[i] is drawn in views[i]
+void draw_boards(GameState *games, BoardView *views, int count);
+
+// Backgrounds and labels, these never change
+void draw_chrome(const BoardView *v);
+
+// A piece with the top left of its grid at x, y in pixels
+void draw_piece(const BoardView *v, Piece p, int x, int y, bool shadow);
+
+// The falling piece and its ghost, and the hint if there is one. The locked
+// blocks are in the stage layer
+void draw_stage(GameState *g, const BoardView *v);
+
+// Where each piece of a perfect clear goes, over the locked blocks
+void draw_hint(const BoardView *v, const PcSolution *s);
+
+// Locked blocks, queue and hold
+void draw_locked(const GameState *g, const BoardView *v);
+
+// Score, level and lines
+void draw_numbers(const GameState *g, const BoardView *v);
+
+void draw_game_over(const BoardView *v);
+
+// The frame timing overlay F3 shows, along the bottom of a w x h screen
+void draw_times(int w, int h);
+
+#endif
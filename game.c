@@ -0,0 +1,679 @@
+#include "game.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "logsys.h"
+
+// Every shape and rotation of PieceDB, kept as a macro so the tables below
+// can all be generated from the same literals at compile time
+#define PIECE_LIST(X) \
+	X(0b0000011001100000,0b0000011001100000,0b0000011001100000,0b0000011001100000) /* O */ \
+	X(0b0100010001000100,0b0000111100000000,0b0010001000100010,0b0000000011110000) /* I */ \
+	X(0b0110010001000000,0b0000111000100000,0b0100010011000000,0b1000111000000000) /* L */ \
+	X(0b0100010001100000,0b0000111010000000,0b1100010001000000,0b0010111000000000) /* J */ \
+	X(0b0110110000000000,0b0100011000100000,0b0000011011000000,0b1000110001000000) /* S */ \
+	X(0b1100011000000000,0b0010011001000000,0b0000110001100000,0b0100110010000000) /* Z */ \
+	X(0b0100111000000000,0b0100011001000000,0b0000111001000000,0b0100110001000000) /* T */
+
+#define PIECE_DB_ENTRY(a, b, c, d) { a, b, c, d },
+const Uint16 PieceDB[7][4] = { PIECE_LIST(PIECE_DB_ENTRY) };
+
+// Constant expression helpers for reading a PieceDB value, block i is x + y*4
+#define BIT(v, n) (((v) >> (n)) & 1)
+#define BLOCK(v, i) BIT(v, 15 - (i))
+#define POPCOUNT16(v) (BIT(v, 0) + BIT(v, 1) + BIT(v, 2) + BIT(v, 3) + \
+	BIT(v, 4) + BIT(v, 5) + BIT(v, 6) + BIT(v, 7) + BIT(v, 8) + BIT(v, 9) + \
+	BIT(v, 10) + BIT(v, 11) + BIT(v, 12) + BIT(v, 13) + BIT(v, 14) + BIT(v, 15))
+// Row y of the grid with the leftmost block in the low bit, like stage rows
+#define GRID_ROW(v, y) (BLOCK(v, (y)*4) | BLOCK(v, (y)*4 + 1) << 1 | \
+	BLOCK(v, (y)*4 + 2) << 2 | BLOCK(v, (y)*4 + 3) << 3)
+#define GRID_COLS(v) (GRID_ROW(v, 0) | GRID_ROW(v, 1) | GRID_ROW(v, 2) | GRID_ROW(v, 3))
+#define GRID_ROWS(v) ((GRID_ROW(v, 0) != 0) | (GRID_ROW(v, 1) != 0) << 1 | \
+	(GRID_ROW(v, 2) != 0) << 2 | (GRID_ROW(v, 3) != 0) << 3)
+#define LOWEST4(m) ((m) & 1 ? 0 : (m) & 2 ? 1 : (m) & 4 ? 2 : 3)
+#define HIGHEST4(m) ((m) & 8 ? 3 : (m) & 4 ? 2 : (m) & 2 ? 1 : 0)
+// Lowest block in column x of the grid, -1 if the column is empty
+#define GRID_COLUMN(v, x) (BLOCK(v, (x)) | BLOCK(v, (x) + 4) << 1 | \
+	BLOCK(v, (x) + 8) << 2 | BLOCK(v, (x) + 12) << 3)
+#define BOTTOM(v, x) (GRID_COLUMN(v, x) ? HIGHEST4(GRID_COLUMN(v, x)) : -1)
+// Grid index of the k-th block in reading order
+#define IS_CELL(v, i, k) (BLOCK(v, i) && POPCOUNT16((v) >> (16 - (i))) == (k))
+#define CELL_INDEX(v, k) (IS_CELL(v, 1, k) * 1 + IS_CELL(v, 2, k) * 2 + \
+	IS_CELL(v, 3, k) * 3 + IS_CELL(v, 4, k) * 4 + IS_CELL(v, 5, k) * 5 + \
+	IS_CELL(v, 6, k) * 6 + IS_CELL(v, 7, k) * 7 + IS_CELL(v, 8, k) * 8 + \
+	IS_CELL(v, 9, k) * 9 + IS_CELL(v, 10, k) * 10 + IS_CELL(v, 11, k) * 11 + \
+	IS_CELL(v, 12, k) * 12 + IS_CELL(v, 13, k) * 13 + IS_CELL(v, 14, k) * 14 + \
+	IS_CELL(v, 15, k) * 15)
+#define CELL(v, k) { CELL_INDEX(v, k) % 4, CELL_INDEX(v, k) / 4 }
+
+#define SHAPE(v) { \
+	{ GRID_ROW(v, 0), GRID_ROW(v, 1), GRID_ROW(v, 2), GRID_ROW(v, 3) }, \
+	LOWEST4(GRID_COLS(v)), HIGHEST4(GRID_COLS(v)), \
+	LOWEST4(GRID_ROWS(v)), HIGHEST4(GRID_ROWS(v)), \
+	{ CELL(v, 0), CELL(v, 1), CELL(v, 2), CELL(v, 3) }, \
+	{ BOTTOM(v, 0), BOTTOM(v, 1), BOTTOM(v, 2), BOTTOM(v, 3) } }
+#define PIECE_SHAPE_ENTRY(a, b, c, d) { SHAPE(a), SHAPE(b), SHAPE(c), SHAPE(d) },
+const PieceShape PieceShapes[7][4] = { PIECE_LIST(PIECE_SHAPE_ENTRY) };
+
+// Internal function prototypes
+bool detect_tspin(const GameState *g, Piece p);
+void reset_speed(GameState *g);
+int clear_lines(GameState *g, int top, int bottom);
+void update_surface(Stage *st, int top);
+void next_piece(GameState *g);
+void update_stage(GameState *g);
+void auto_shift(GameState *g, int elapsed);
+void key_event(GameState *g, InputEvent e);
+
+// Order game_step applies keys that changed in the same frame
+const InputBits KeyOrder[] = {
+	INPUT_ENTER, INPUT_LEFT, INPUT_RIGHT, INPUT_Z, INPUT_X, INPUT_UP,
+	INPUT_SPACE, INPUT_SHIFT, INPUT_DOWN, INPUT_ESC
+};
+#define KEY_COUNT (int)(sizeof(KeyOrder) / sizeof(KeyOrder[0]))
+
+const StageSize StandardStage = { STAGE_W, STAGE_H, 0 };
+
+// Key state helper, held right now
+static bool key_held(const GameState *g, InputBits k) { return (g->keys & k) != 0; }
+
+void game_reset(GameState *g) {
+	// Clear the stage, it stays the same size
+	StageSize size = g->stage.size;
+	memset(&g->stage, 0, sizeof(g->stage));
+	g->stage.size = size;
+	g->stage.full = (Row)((1 << size.width) - 1);
+	memset(g->stage.surface, size.height, sizeof(g->stage.surface));
+	g->ghostValid = false;
+	// Fill the queue, next_piece below takes the first piece from it.
+	// The bag carries on from where the last game left off
+	for(int i = 0; i < 5; i++) {
+		g->queue[i].type = bag_next(&g->bag);
+		g->queue[i].flip = 0;
+	}
+	// Default values
+	g->hold = (Piece){ 0 };
+	g->heldSomething = false;
+	g->holded = false;
+	g->paused = false;
+	g->dropping = false;
+	g->score = 0;
+	g->level = 0;
+	g->nextLevel = LINES_PER_LEVEL;
+	g->linesCleared = 0;
+	g->totalLines = 0;
+	g->blockTime = 0;
+	g->autoShift = SHIFT_DELAY;
+	g->shiftDirection = 0;
+	// The keys are left as they are, whatever is held through the restart
+	// is still held in the new game. game_setup starts them all up
+	g->frames = 0;
+	g->pieces = 0;
+	g->clearedRows = 0;
+	g->stageChanges++;
+	reset_speed(g);
+	next_piece(g);
+	g->mode = MODE_STAGE;
+}
+
+void game_seed(GameState *g, Uint64 seed) {
+	game_setup(g, seed, StandardStage);
+}
+
+void game_setup(GameState *g, Uint64 seed, StageSize size) {
+	// Start from all zeroes, padding included, so the same game always has
+	// the same bytes and snapshots of it can be compared
+	memset(g, 0, sizeof(GameState));
+	g->stage.size = size;
+	bag_seed(&g->bag, seed);
+	game_reset(g);
+}
+
+bool stage_size_valid(StageSize size) {
+	return size.width >= MIN_STAGE_W && size.width <= MAX_STAGE_W &&
+		size.height <= MAX_STAGE_H && size.hidden <= size.height &&
+		size.height - size.hidden >= MIN_STAGE_H;
+}
+
+bool stage_size_parse(const char *text, StageSize *size) {
+	// The guideline stage is known by its full height
+	if(strcmp(text, "10x40") == 0) {
+		*size = (StageSize){ 10, 40, 20 };
+		return true;
+	}
+	int w, h, hidden = 0, end = 0, more = 0;
+	if(sscanf(text, "%dx%d%n", &w, &h, &end) != 2) return false;
+	if(text[end] == '+' && sscanf(text + end + 1, "%d%n", &hidden, &more) == 1) end += 1 + more;
+	if(text[end] != '\0' || w < 0 || w > MAX_STAGE_W || h < 0 || hidden < 0 ||
+			h + hidden > MAX_STAGE_H) return false;
+	*size = (StageSize){ w, h + hidden, hidden };
+	return stage_size_valid(*size);
+}
+
+// Move to the left if possible
+void move_piece_left(GameState *g) {
+	Piece p = g->piece;
+	p.x--;
+	if(validate_piece(g, p)) {
+		g->piece = p;
+		// Reset timer if next fall will lock
+		if(check_lock(g, p)) g->blockTime = 0;
+	}
+}
+
+// Move to the right if possible
+void move_piece_right(GameState *g) {
+	Piece p = g->piece;
+	p.x++;
+	if(validate_piece(g, p)) {
+		g->piece = p;
+		// Reset timer if next fall will lock
+		if(check_lock(g, g->piece)) g->blockTime = 0;
+	}
+}
+
+// Move down or lock
+void move_piece_down(GameState *g) {
+	if(check_lock(g, g->piece)) {
+		lock_piece(g);
+	} else {
+		g->piece.y++;
+		if(g->dropping) g->score += SCORE_SOFT_DROP;
+	}
+	g->blockTime = 0;
+}
+
+// Rotate to the left if possible
+void rotate_piece_left(GameState *g) {
+	Piece p = g->piece;
+	if(p.flip == 0) p.flip = 3; else p.flip--;
+	// If rotating makes the piece overlap, try to wall kick
+	if(validate_piece(g, p) || wall_kick(g, &p)) {
+		g->piece = p;
+		// Reset timer if next fall will lock
+		if(check_lock(g, g->piece)) g->blockTime = 0;
+	}
+}
+
+// Rotate to the right if possible
+void rotate_piece_right(GameState *g) {
+	Piece p = g->piece;
+	if(p.flip == 3) p.flip = 0; else p.flip++;
+	// If rotating makes the piece overlap, try to wall kick
+	if(validate_piece(g, p) || wall_kick(g, &p)) {
+		g->piece = p;
+		// Reset timer if next fall will lock
+		if(check_lock(g, g->piece)) g->blockTime = 0;
+	}
+}
+
+// Drop piece to the bottom and lock it
+void hard_drop(GameState *g) {
+	int distance = drop_distance(g, g->piece);
+	g->piece.y += distance;
+	g->score += SCORE_HARD_DROP * distance;
+	lock_piece(g);
+}
+
+// Switch current and hold block
+void hold_piece(GameState *g) {
+	if(g->holded) return; // Don't hold twice in a row
+	g->piece.x = (g->stage.size.width - 4) / 2;
+	g->piece.y = g->stage.size.hidden;
+	if(g->heldSomething) {
+		Piece temp = g->piece;
+		g->piece = g->hold;
+		g->hold = temp;
+	} else {
+		g->hold = g->piece;
+		g->heldSomething = true;
+		next_piece(g);
+	}
+	g->holded = true;
+	g->stageChanges++;
+}
+
+// Lock piece into stage and spawn the next
+void lock_piece(GameState *g) {
+	Piece piece = g->piece;
+	// Push piece data into stage
+	const PieceShape *s = &PieceShapes[piece.type][piece.flip];
+	for(int i = 0; i < 4; i++) {
+		int x = piece.x + s->cells[i].x, y = piece.y + s->cells[i].y;
+		// Blocks above the top of the stage are lost
+		if(y < 0) continue;
+		Row old = g->stage.rows[y];
+		g->stage.rows[y] |= 1 << x;
+		g->stage.hash ^= zobrist_row(y, old) ^ zobrist_row(y, g->stage.rows[y]);
+		g->stage.color[y][x] = piece.type+1;
+		if(y < g->stage.surface[x]) g->stage.surface[x] = y;
+	}
+	g->ghostValid = false;
+	// Clear any completed rows, only the ones the piece touched can be full
+	int rows_cleared = clear_lines(g, piece.y + s->minY, piece.y + s->maxY);
+	// Score rewards
+	int reward = 0, level = g->level;
+	// 3-corner T-spin
+	if(piece.type == 7 && detect_tspin(g, piece)) {
+		switch(rows_cleared) {
+			case 0: reward += SCORE_TSPIN * level; break;
+			case 1: reward += SCORE_TSPIN_SINGLE * level; break;
+			case 2: reward += SCORE_TSPIN_DOUBLE * level; break;
+		}
+	} else {
+		// Immobile (EZ) T-spin
+		Piece p = piece;
+		if(piece.type == 7 && wall_kick(g, &p)) {
+			switch(rows_cleared) {
+				case 0: reward += SCORE_EZ_TSPIN * level; break;
+				case 1: reward += SCORE_EZ_TSPIN_SINGLE * level; break;
+			}
+		} else {
+			// Rows clear, no T-spin
+			switch (rows_cleared) {
+				case 1: reward += SCORE_SINGLE * level; break;
+				case 2: reward += SCORE_DOUBLE * level; break;
+				case 3: reward += SCORE_TRIPLE * level; break;
+				case 4: reward += SCORE_TETRIS * level; break;
+			}
+		}
+	}
+	g->score += reward;
+	// Update line total and level
+	g->linesCleared += rows_cleared;
+	g->totalLines += rows_cleared;
+	g->nextLevel -= rows_cleared;
+	if (g->nextLevel <= 0) {
+		g->nextLevel += LINES_PER_LEVEL;
+		g->level++;
+	}
+	g->pieces++;
+	g->stageChanges++;
+	next_piece(g);
+}
+
+// Checks if the piece is overlapping with anything
+bool validate_piece(const GameState *g, Piece p) {
+	const PieceShape *s = &PieceShapes[p.type][p.flip];
+	// Walls and floor, one range test for the whole piece
+	if(p.x + s->minX < 0 || p.x + s->maxX >= g->stage.size.width ||
+			p.y + s->maxY >= g->stage.size.height) {
+		return false;
+	}
+	// Blocks can't fall off the sides anymore so the shift is exact
+	for(int j = s->minY; j <= s->maxY; j++) {
+		int y = p.y + j;
+		if(y < 0) continue;
+		Row m = p.x >= 0 ? s->rows[j] << p.x : s->rows[j] >> -p.x;
+		if(g->stage.rows[y] & m) return false;
+	}
+	return true;
+}
+
+// Check if piece can be moved down any further
+bool check_lock(const GameState *g, Piece p) {
+	p.y++;
+	return !validate_piece(g, p);
+}
+
+// Whether a cell is filled, walls and the floor count as filled
+static bool block_filled(const GameState *g, int x, int y) {
+	if(x < 0 || x >= g->stage.size.width || y >= g->stage.size.height) return true;
+	return y >= 0 && (g->stage.rows[y] & (1 << x));
+}
+
+bool detect_tspin(const GameState *g, Piece p) {
+	return block_filled(g, p.x, p.y) + block_filled(g, p.x + 2, p.y) +
+		block_filled(g, p.x + 2, p.y + 2) + block_filled(g, p.x, p.y + 2) == 3;
+}
+
+// Try to push the piece out of an obstacles way
+bool wall_kick(const GameState *g, Piece *p) {
+	// Left
+	p->x -= 1;
+	if(validate_piece(g, *p)) return true;
+	// Right
+	p->x += 2;
+	if(validate_piece(g, *p)) return true;
+	// Up
+	p->x -= 1;
+	p->y -= 1;
+	if(validate_piece(g, *p)) return true;
+	// Unable to wall kick, return piece to the way it was
+	p->y += 1;
+	return false;
+}
+
+// Number of rows the piece can fall before it would lock
+int drop_distance(const GameState *g, Piece p) {
+	const PieceShape *s = &PieceShapes[p.type][p.flip];
+	int distance = g->stage.size.height;
+	// Each column of the piece lands on the top block of its stage column,
+	// as long as the piece is above that block to begin with
+	for(int i = s->minX; i <= s->maxX; i++) {
+		int gap = g->stage.surface[p.x + i] - (p.y + s->bottom[i]) - 1;
+		if(gap < 0) {
+			// Tucked under an overhang, fall back to stepping down
+			distance = 0;
+			while(!check_lock(g, p)) { p.y++; distance++; }
+			return distance;
+		}
+		if(gap < distance) distance = gap;
+	}
+	return distance;
+}
+
+// Returns a shadow to display where the piece will drop
+Piece ghost_piece(const GameState *g, Piece p) {
+	p.y += drop_distance(g, p);
+	return p;
+}
+
+// Ghost of the current piece, only recalculated when the piece or the
+// stage has changed since the last call
+Piece game_ghost(GameState *g) {
+	Piece p = g->piece;
+	if(!g->ghostValid || p.x != g->ghostOf.x || p.y != g->ghostOf.y ||
+			p.type != g->ghostOf.type || p.flip != g->ghostOf.flip) {
+		g->ghostOf = p;
+		g->ghost = ghost_piece(g, p);
+		g->ghostValid = true;
+	}
+	return g->ghost;
+}
+
+// Keys come from mixing what they stand for rather than a table of random
+// numbers, so there is nothing to fill in and any stage size works. The
+// tag keeps rows and the other parts of game_hash apart
+#define ZOBRIST_ROW (1ull << 56)
+#define ZOBRIST_PIECE (2ull << 56)
+#define ZOBRIST_HOLD (3ull << 56)
+#define ZOBRIST_QUEUE (4ull << 56)
+
+// SplitMix64's finalizer
+static Uint64 zobrist_key(Uint64 x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+Uint64 zobrist_row(int y, Row bits) {
+	return bits ? zobrist_key(ZOBRIST_ROW | (Uint64)y << 32 | bits) : 0;
+}
+
+Uint64 game_hash(const GameState *g) {
+	Uint64 hash = g->stage.hash ^ zobrist_key(ZOBRIST_PIECE | g->piece.type) ^
+		zobrist_key(ZOBRIST_HOLD | (g->heldSomething ? g->hold.type : 7) | g->holded << 4);
+	for(int i = 0; i < 5; i++) hash ^= zobrist_key(ZOBRIST_QUEUE | i << 8 | g->queue[i].type);
+	return hash;
+}
+
+// Keys the random driver is allowed to press, never pause or quit
+const InputBits RandomKeys[] = {
+	0, INPUT_LEFT, INPUT_RIGHT, INPUT_DOWN, INPUT_Z, INPUT_X, INPUT_UP,
+	INPUT_SPACE, INPUT_SHIFT, INPUT_LEFT | INPUT_DOWN, INPUT_RIGHT | INPUT_DOWN
+};
+#define RANDOM_KEY_COUNT (sizeof(RandomKeys) / sizeof(RandomKeys[0]))
+
+Uint32 random_input_seed(Uint64 seed) {
+	return (Uint32)(seed * 2654435761u) | 1; // xorshift gets stuck on zero
+}
+
+// Small xorshift generator, separate from the bag's so pressing keys
+// never changes the pieces
+InputBits random_input(Uint32 *state, InputBits last) {
+	Uint32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	if(x % 8 != 0) return last;
+	return RandomKeys[(x >> 8) % RANDOM_KEY_COUNT];
+}
+
+// Adjusts the fall speed based on the current level
+void reset_speed(GameState *g) {
+	g->blockSpeed = INITIAL_SPEED - (g->level * 5);
+	if(g->blockSpeed < DROP_SPEED) g->blockSpeed = DROP_SPEED;
+}
+
+// Clear the full rows between top and bottom and move down the rows above
+// them, all in one pass. The cleared rows are left in clearedRows
+int clear_lines(GameState *g, int top, int bottom) {
+	Stage *st = &g->stage;
+	Uint64 cleared = 0;
+	int count = 0;
+	if(top < 0) top = 0;
+	if(bottom >= st->size.height) bottom = st->size.height - 1;
+	for(int y = top; y <= bottom; y++) {
+		if(st->rows[y] != st->full) continue;
+		cleared |= 1ull << y;
+		st->hash ^= zobrist_row(y, st->full);
+		count++;
+	}
+	g->clearedRows = cleared;
+	if(!count) return 0;
+	// Walk up from the bottom cleared row to the top of the stack copying
+	// every row that survives into the next free slot. Clears can leave
+	// empty rows inside the stack under an overhang, so those get copied
+	// like any other
+	int stackTop = st->size.height;
+	for(int x = 0; x < st->size.width; x++) {
+		if(st->surface[x] < stackTop) stackTop = st->surface[x];
+	}
+	int dst = bottom, src;
+	for(src = bottom; src >= stackTop; src--) {
+		if(cleared & (1ull << src)) continue;
+		if(dst != src) {
+			// Whatever was in dst has already been hashed out, cleared or moved
+			st->hash ^= zobrist_row(src, st->rows[src]) ^ zobrist_row(dst, st->rows[src]);
+			st->rows[dst] = st->rows[src];
+			memcpy(st->color[dst], st->color[src], sizeof(st->color[0]));
+		}
+		dst--;
+	}
+	// Rows between the top of the stack and its old position are now empty
+	for(int y = src + 1; y <= dst; y++) {
+		st->rows[y] = 0;
+		memset(st->color[y], 0, sizeof(st->color[0]));
+	}
+	update_surface(st, dst + 1);
+	return count;
+}
+
+// Find the top block of every column again, top is the highest row that
+// can have anything in it
+void update_surface(Stage *st, int top) {
+	Row seen = 0;
+	memset(st->surface, st->size.height, sizeof(st->surface));
+	for(int y = top; y < st->size.height && seen != st->full; y++) {
+		Row found = st->rows[y] & ~seen;
+		seen |= found;
+		for(int x = 0; found; x++, found >>= 1) {
+			if(found & 1) st->surface[x] = y;
+		}
+	}
+}
+
+// Shift to the next block in the queue
+void next_piece(GameState *g) {
+	// Centered, with its top rows above the shown part of the stage
+	g->piece = g->queue[0];
+	g->piece.y = g->stage.size.hidden - 2;
+	g->piece.x = (g->stage.size.width - 4) / 2;
+	for(int i = 0; i < 4; i++) g->queue[i] = g->queue[i+1];
+	// Grab piece from the bag, it refills itself when it runs out
+	g->queue[4].type = bag_next(&g->bag);
+	g->holded = false; // Allow player to hold the next piece
+	// End the game if the next piece overlaps
+	if(!validate_piece(g, g->piece)) g->mode = MODE_GAMEOVER;
+	reset_speed(g);
+}
+
+void game_step(GameState *g, InputBits input) {
+	InputEvent events[KEY_COUNT];
+	int count = game_input_events(g, input, events);
+	game_step_events(g, events, count);
+}
+
+int game_input_events(const GameState *g, InputBits input, InputEvent *events) {
+	InputBits changed = input ^ g->keys;
+	int count = 0;
+	for(int i = 0; changed && i < KEY_COUNT; i++) {
+		if(!(changed & KeyOrder[i])) continue;
+		changed &= ~KeyOrder[i];
+		events[count++] = (InputEvent){ KeyOrder[i], (input & KeyOrder[i]) != 0, 0 };
+	}
+	return count;
+}
+
+void game_step_events(GameState *g, const InputEvent *events, int count) {
+	g->oldKeys = g->keys;
+	g->frames++;
+	// Auto shift runs on time in between the keys, so a shift that comes
+	// due before a rotate happens before it
+	int now = 0;
+	for(int i = 0; i < count; i++) {
+		auto_shift(g, events[i].time - now);
+		now = events[i].time;
+		key_event(g, events[i]);
+	}
+	auto_shift(g, FRAME_US - now);
+	if(g->mode == MODE_STAGE) update_stage(g);
+}
+
+// Auto shift for game_step_frames, counted in frames
+#define FRAME_SHIFT_DELAY 20
+#define FRAME_SHIFT_SPEED 4
+
+static bool key_pressed(const GameState *g, InputBits k) { return (g->keys & ~g->oldKeys & k) != 0; }
+static bool key_released(const GameState *g, InputBits k) { return (g->oldKeys & ~g->keys & k) != 0; }
+
+void game_step_frames(GameState *g, InputBits input) {
+	// Auto shift started out counting frames too
+	if(g->frames == 0) g->autoShift = FRAME_SHIFT_DELAY;
+	g->oldKeys = g->keys;
+	g->keys = input;
+	g->frames++;
+	if(g->mode == MODE_GAMEOVER) {
+		if(key_pressed(g, INPUT_ENTER)) {
+			game_reset(g);
+			// Restarting let go of every key back then
+			g->keys = g->oldKeys = 0;
+		}
+		return;
+	}
+	if(g->mode != MODE_STAGE) return;
+	if(key_pressed(g, INPUT_ENTER)) g->paused = !g->paused;
+	if(g->paused) return;
+	// Only one of left and right in a frame, left first
+	if(key_pressed(g, INPUT_LEFT)) {
+		move_piece_left(g);
+		g->shiftDirection = -1;
+		g->autoShift = FRAME_SHIFT_DELAY;
+	} else if(key_pressed(g, INPUT_RIGHT)) {
+		move_piece_right(g);
+		g->shiftDirection = 1;
+		g->autoShift = FRAME_SHIFT_DELAY;
+	}
+	if(key_held(g, INPUT_RIGHT) - key_held(g, INPUT_LEFT) == g->shiftDirection) {
+		g->autoShift--;
+		if(g->autoShift == 0) {
+			g->autoShift = FRAME_SHIFT_SPEED;
+			if(key_held(g, INPUT_LEFT)) move_piece_left(g);
+			else if(key_held(g, INPUT_RIGHT)) move_piece_right(g);
+		}
+	}
+	if(key_pressed(g, INPUT_Z)) rotate_piece_left(g);
+	if(key_pressed(g, INPUT_X)) rotate_piece_right(g);
+	if(key_pressed(g, INPUT_UP)) rotate_piece_right(g);
+	if(key_pressed(g, INPUT_SPACE)) hard_drop(g);
+	if(key_pressed(g, INPUT_SHIFT)) hold_piece(g);
+	if(key_pressed(g, INPUT_DOWN)) {
+		g->blockSpeed = DROP_SPEED;
+		g->dropping = true;
+		move_piece_down(g);
+	} else if(key_released(g, INPUT_DOWN)) {
+		reset_speed(g);
+		g->dropping = false;
+	}
+	update_stage(g);
+}
+
+// Applies one key going down or up, whatever it does happens right away
+void key_event(GameState *g, InputEvent e) {
+	if(e.down) g->keys |= e.key;
+	else g->keys &= ~e.key;
+	if(g->mode == MODE_GAMEOVER) {
+		// Game over screen
+		if(e.down && e.key == INPUT_ENTER) game_reset(g);
+		return;
+	}
+	if(g->mode != MODE_STAGE) return;
+	if(e.down && e.key == INPUT_ENTER) g->paused = !g->paused;
+	// Don't update the rest if the game is paused
+	if(g->paused) return;
+	if(!e.down) {
+		if(e.key == INPUT_DOWN) {
+			reset_speed(g);
+			g->dropping = false;
+		}
+		return;
+	}
+	switch(e.key) {
+		// Moving left and right
+		case INPUT_LEFT:
+		move_piece_left(g);
+		g->shiftDirection = -1;
+		g->autoShift = SHIFT_DELAY;
+		break;
+		case INPUT_RIGHT:
+		move_piece_right(g);
+		g->shiftDirection = 1;
+		g->autoShift = SHIFT_DELAY;
+		break;
+		// Rotating block
+		case INPUT_Z: rotate_piece_left(g); break;
+		case INPUT_X: rotate_piece_right(g); break;
+		case INPUT_UP: rotate_piece_right(g); break;
+		// Drop and Lock
+		case INPUT_SPACE: hard_drop(g); break;
+		// Hold a block and save it for later
+		case INPUT_SHIFT: hold_piece(g); break;
+		// If we hold the down key fall faster
+		case INPUT_DOWN:
+		g->blockSpeed = DROP_SPEED;
+		g->dropping = true;
+		move_piece_down(g);
+		break;
+	}
+}
+
+// Delayed Auto Shift, lets elapsed microseconds pass with the keys as they are
+void auto_shift(GameState *g, int elapsed) {
+	if(g->mode != MODE_STAGE || g->paused || g->shiftDirection == 0) return;
+	if(key_held(g, INPUT_RIGHT) - key_held(g, INPUT_LEFT) != g->shiftDirection) return;
+	g->autoShift -= elapsed;
+	while(g->autoShift <= 0) {
+		g->autoShift += SHIFT_SPEED;
+		if(g->shiftDirection < 0) move_piece_left(g);
+		else move_piece_right(g);
+	}
+}
+
+// Update actions when the game is being played, once per frame after the
+// keys have been handled
+void update_stage(GameState *g) {
+	// Don't update the rest if the game is paused
+	if(g->paused) return;
+	// Push block down according to speed
+	g->blockTime++;
+	if(g->blockTime >= g->blockSpeed) {
+		// No matter the gravity, always wait at least half a second
+		// before locking
+		if(!check_lock(g, g->piece) || g->blockTime >= LOCK_DELAY || key_held(g, INPUT_DOWN)) {
+			move_piece_down(g);
+		}
+	}
+}
@@ -0,0 +1,250 @@
+#ifndef TETRIS_GAME
+#define TETRIS_GAME
+
+#include "types.h"
+#include "random.h"
+
+// Size of the standard stage
+#define STAGE_W 10
+#define STAGE_H 20
+// Largest stage a game can be set up with. A row has to fit in a Row, and
+// the rows one lock clears in clearedRows
+#define MAX_STAGE_W 16
+#define MAX_STAGE_H 40
+// Smallest, every piece has to fit across and below the spawn rows
+#define MIN_STAGE_W 4
+#define MIN_STAGE_H 4
+// Number of lines to clear before going to the next level
+#define LINES_PER_LEVEL 20
+// "SPEED" is actually number of frames here
+// Initial speed is the "gravity" for level 1
+#define INITIAL_SPEED 60
+// Gravity for soft drop when player holds the down button
+#define DROP_SPEED 4
+// Minimum time a between a piece touching the bottom and locking
+#define LOCK_DELAY 30
+// Length of one game_step in microseconds, 60 steps a second
+#define FRAME_US 16667
+// For delayed auto shift, wait SHIFT_DELAY microseconds first, then
+// move every SHIFT_SPEED while left/right continues to be held. Counted
+// from the moment the key went down, not from the frame it was seen in
+#define SHIFT_DELAY 333333
+#define SHIFT_SPEED 66667
+
+// Score amounts rewarded for various actions
+#define SCORE_SINGLE 100
+#define SCORE_DOUBLE 300
+#define SCORE_TRIPLE 500
+#define SCORE_TETRIS 800
+#define SCORE_EZ_TSPIN 100
+#define SCORE_EZ_TSPIN_SINGLE 200
+#define SCORE_TSPIN 400
+#define SCORE_TSPIN_SINGLE 800
+#define SCORE_TSPIN_DOUBLE 1200
+#define SCORE_SOFT_DROP 1
+#define SCORE_HARD_DROP 2
+
+// Game mode, like using screens except a single variable switch instead
+#define MODE_TITLE 0
+#define MODE_OPTIONS 1
+#define MODE_STAGE 2
+#define MODE_GAMEOVER 3
+
+// One bit for each key the game logic cares about, a frame of input
+// is the set of keys that are held down during that frame
+typedef Uint16 InputBits;
+enum {
+	INPUT_UP    = 1<<0,
+	INPUT_DOWN  = 1<<1,
+	INPUT_LEFT  = 1<<2,
+	INPUT_RIGHT = 1<<3,
+	INPUT_Z     = 1<<4,
+	INPUT_X     = 1<<5,
+	INPUT_SHIFT = 1<<6,
+	INPUT_SPACE = 1<<7,
+	INPUT_ENTER = 1<<8,
+	INPUT_ESC   = 1<<9
+};
+
+// A key going down or up part way through a frame
+typedef struct {
+	InputBits key;
+	bool down;
+	// Microseconds into the frame, from 0 up to FRAME_US
+	Uint16 time;
+} InputEvent;
+
+// Most key events one frame can take
+#define MAX_FRAME_EVENTS 16
+
+// One bit per column of a stage row, bit x is set when column x is filled
+typedef Uint16 Row;
+
+// Dimensions of a stage, picked when the game is set up
+typedef struct {
+	// Columns, and rows counting the hidden ones
+	Uint8 width, height;
+	// Rows at the top that are never drawn. Pieces spawn in them and play
+	// goes on in them as normal, a buffer zone for tall stages
+	Uint8 hidden;
+} StageSize;
+
+// 10x20 with nothing hidden, the size the game always had
+extern const StageSize StandardStage;
+
+// Blocks that have fallen and became part of the stage. Collision and line
+// clears only look at the occupancy rows, the colors are only for drawing.
+// Only the first size.height rows and size.width columns are used
+typedef struct {
+	Row rows[MAX_STAGE_H];
+	// Piece type + 1 of the block in each cell, 0 when empty
+	Uint8 color[MAX_STAGE_H][MAX_STAGE_W];
+	// Row of the top block in each column, size.height when the column is empty
+	Uint8 surface[MAX_STAGE_W];
+	// Zobrist hash of the rows, kept up to date as pieces lock and lines
+	// clear. An empty stage hashes to 0
+	Uint64 hash;
+	StageSize size;
+	// A row with every column filled
+	Row full;
+} Stage;
+
+// Represents an "instance" of a piece
+typedef struct {
+	// X and Y position (in blocks) on the stage
+	Sint8 x; Sint8 y;
+	// Type and flip value to index the PieceDB array
+	Uint8 type; Uint8 flip;
+} Piece;
+
+// Precomputed layout of one entry of PieceDB, all positions are relative to
+// the top left of the piece's 4x4 grid
+typedef struct {
+	// Blocks in each row of the grid, in the same bit order as stage rows
+	Row rows[4];
+	// Bounding box of the blocks, inclusive
+	Sint8 minX, maxX, minY, maxY;
+	// Position of each of the 4 blocks, in reading order
+	struct { Sint8 x, y; } cells[4];
+	// Lowest block in each column of the grid, -1 for empty columns
+	Sint8 bottom[4];
+} PieceShape;
+
+// Everything needed to run one game, there are no globals in the game logic
+// so any number of these can be simulated side by side
+typedef struct {
+	// Current game mode (title screen, stage, game over screen, etc)
+	int mode;
+	// Contains blocks/pieces that have fallen and bacame part of the stage
+	Stage stage;
+	// Random bag used to decide piece order, each game has its own
+	Bag bag;
+	// Block speed is the falling speed measured in frames between motions
+	// The block time is the elapsed frames which counts up to block speed
+	int blockSpeed, blockTime;
+	// Player's stats, score, level, etc
+	int score, linesCleared, totalLines, level, nextLevel;
+	// Current piece controlled by player, held for later, and the queue
+	Piece piece, hold, queue[5];
+	// Whether the player held the previous piece, and has held any piece yet
+	bool holded, heldSomething;
+	// Whether game is paused
+	bool paused;
+	// True if the player is holding down to soft drop a piece
+	bool dropping;
+	// Microseconds until the next automatic shift, and the direction the
+	// piece is being shifted
+	int autoShift, shiftDirection;
+	// Keys held this frame and the previous frame
+	InputBits keys, oldKeys;
+	// Number of times game_step has been called and pieces locked since reset
+	Uint32 frames, pieces;
+	// Rows cleared by the last piece to lock, bit y set for row y as it was
+	// before the rows above it moved down. For animating and scoring
+	Uint64 clearedRows;
+	// Cached result of game_ghost, and the piece it was worked out for
+	Piece ghost, ghostOf;
+	bool ghostValid;
+	// Goes up whenever the locked blocks, queue, hold or level change, so
+	// anything drawing them knows when to draw them again
+	Uint32 stageChanges;
+} GameState;
+
+// This array describes the block configuration of a piece, for each shape
+// and rotation in a 4x4 grid ordered left to right, then top to bottom
+// Indexed: PieceDB[type][flip]
+extern const Uint16 PieceDB[7][4];
+
+// PieceDB unpacked into the forms the hot paths want, built at compile time
+// from the same literals. Indexed: PieceShapes[type][flip]
+extern const PieceShape PieceShapes[7][4];
+
+// Put values back to their defaults and start over, on a stage the same
+// size as before
+void game_reset(GameState *g);
+
+// Start over on a standard stage with the piece order decided by seed
+void game_seed(GameState *g, Uint64 seed);
+
+// Start over on a stage of the given size, which has to be valid
+void game_setup(GameState *g, Uint64 seed, StageSize size);
+
+// Whether a game can be set up with this size
+bool stage_size_valid(StageSize size);
+
+// Reads a size from the command line, "WxH" for W columns and H rows all
+// shown, "WxH+N" for N more hidden above them. "10x40" is the guideline
+// stage, 20 rows shown and 20 hidden. False if text isn't a valid size
+bool stage_size_parse(const char *text, StageSize *size);
+
+// Advance the game by one frame, input is the keys held during that frame.
+// Keys that changed count as changing at the start of the frame
+void game_step(GameState *g, InputBits input);
+
+// Advance the game by one frame, applying each key change at the time in
+// the frame it happened. Events must be in time order
+void game_step_events(GameState *g, const InputEvent *events, int count);
+
+// The events game_step(g, input) would apply, returns how many
+int game_input_events(const GameState *g, InputBits input, InputEvent *events);
+
+// Advance the game by one frame the way game_step did before it took key
+// events, for replays recorded then. The keys are read once at the start,
+// auto shift counts frames and runs straight after left and right, and
+// restarting takes the whole frame. A game stepped this way from its first
+// frame plays out the same as it did back then
+void game_step_frames(GameState *g, InputBits input);
+
+// Individual actions, these are what the keys end up calling
+void move_piece_left(GameState *g);
+void move_piece_right(GameState *g);
+void move_piece_down(GameState *g);
+void rotate_piece_left(GameState *g);
+void rotate_piece_right(GameState *g);
+void hard_drop(GameState *g);
+void hold_piece(GameState *g);
+void lock_piece(GameState *g);
+
+// Queries against the stage, these don't modify the game
+bool validate_piece(const GameState *g, Piece p);
+bool check_lock(const GameState *g, Piece p);
+bool wall_kick(const GameState *g, Piece *p);
+Piece ghost_piece(const GameState *g, Piece p);
+int drop_distance(const GameState *g, Piece p);
+
+// Ghost of the current piece, cached until the piece or stage changes
+Piece game_ghost(GameState *g);
+
+// Zobrist key of row y holding bits, the stage hash is these XORed together
+Uint64 zobrist_row(int y, Row bits);
+
+// Hash of everything that decides where the game can go from here: the
+// stage, the current piece type, the hold and the queue
+Uint64 game_hash(const GameState *g);
+
+// Mashes random keys for soak testing, each choice held for a few frames.
+// state starts from random_input_seed, last is the keys it gave before
+Uint32 random_input_seed(Uint64 seed);
+InputBits random_input(Uint32 *state, InputBits last);
+
+#endif
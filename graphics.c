@@ -1,67 +1,244 @@
 #include "graphics.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "capture.h"
 #include "logsys.h"
 
-#define MAX_TEXT 100
+// Quads drawn in one SDL_RenderGeometry call, more than that flush early
+#define MAX_QUADS 1024
+// Blocks are all drawn from this texture, tinted by the vertex colors
+#define BLOCK_TEXTURE_SIZE 4
+// Characters rasterized into the font atlas, printable ASCII
+#define GLYPH_FIRST ' '
+#define GLYPH_LAST '~'
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+#define ATLAS_WIDTH 256
 
 SDL_Window *window;
 SDL_Renderer *renderer;
+// What the software renderer draws into when there's no window
+SDL_Surface *screen;
+// Frames shown are written here once graphics_capture opens it, readback
+// holds them when they have to be read back from a window first
+Capture capture;
+Uint8 *readback;
+
+int screenWidth, screenHeight;
 
-long frameTime;
+struct { SDL_Texture *texture; int valid; } layer[MAX_LAYERS];
 
 TTF_Font *font;
-struct { char *string; SDL_Texture *texture; } text[MAX_TEXT];
-int text_count = 0;
+// Every glyph is rendered once into the atlas, and drawn from there
+SDL_Texture *atlas;
+struct { SDL_Rect rect; int advance; } glyph[GLYPH_COUNT];
+Sint8 kerning[GLYPH_COUNT][GLYPH_COUNT];
+int atlasWidth, atlasHeight;
+// Text is tinted with the last color set
+SDL_Color textColor = { 0, 0, 0, 255 };
+
+SDL_Texture *blockTexture;
+// Quads waiting to be drawn, all from the same texture
+SDL_Texture *batchTexture;
+SDL_Vertex batchVertices[MAX_QUADS * 4];
+int batchIndices[MAX_QUADS * 6];
+int batchCount = 0;
 
 // Internal function prototypes
-void graphics_generate_text(char *string);
-void graphics_wipe_text();
-void graphics_draw_texture(SDL_Texture *texture, int x, int y);
+void graphics_create_atlas();
+void graphics_queue_quad(SDL_Texture *texture, SDL_FRect dst, SDL_FRect src, SDL_Color c);
+void graphics_create_blocks();
+void graphics_create_layers();
+void graphics_setup(int x, int y);
+void graphics_capture_frame();
 
-void graphics_init(int x, int y) {
+void graphics_init(int x, int y, int vsync) {
 	if(SDL_Init(SDL_INIT_VIDEO)==-1) {
 		log_msgf(FATAL, "SDL_Init: %s\n", SDL_GetError());
 	}
+	// Has to be set before the renderer is created
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC, vsync ? "1" : "0");
 	if(SDL_CreateWindowAndRenderer(x, y, 0, &window, &renderer) == -1) {
 		log_msgf(FATAL, "SDL_CreateWindowAndRenderer: %s\n", SDL_GetError());
 	}
 	SDL_SetWindowTitle(window, "Tetris");
+	graphics_setup(x, y);
+}
+
+void graphics_init_offscreen(int x, int y) {
+	// No subsystems, the software renderer draws with the CPU alone
+	if(SDL_Init(0)==-1) {
+		log_msgf(FATAL, "SDL_Init: %s\n", SDL_GetError());
+	}
+	screen = SDL_CreateRGBSurfaceWithFormat(0, x, y, 32, SDL_PIXELFORMAT_RGBA32);
+	if(!screen) {
+		log_msgf(FATAL, "SDL_CreateRGBSurfaceWithFormat: %s\n", SDL_GetError());
+	}
+	renderer = SDL_CreateSoftwareRenderer(screen);
+	if(!renderer) {
+		log_msgf(FATAL, "SDL_CreateSoftwareRenderer: %s\n", SDL_GetError());
+	}
+	graphics_setup(x, y);
+}
+
+// Everything after the renderer exists, the same with or without a window
+void graphics_setup(int x, int y) {
 	if(TTF_Init()==-1) {
 		log_msgf(ERROR, "TTF_Init: %s\n", TTF_GetError());
 	}
-	frameTime = SDL_GetTicks();
+	screenWidth = x;
+	screenHeight = y;
+	graphics_create_blocks();
+	graphics_create_layers();
+	// The first frame starts from the same background graphics_flip clears to
+	SDL_SetRenderDrawColor(renderer, 0, 192, 0, 255);
+	SDL_RenderClear(renderer);
+}
+
+void graphics_create_layers() {
+	for(int i = 0; i < MAX_LAYERS; i++) {
+		layer[i].texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+			SDL_TEXTUREACCESS_TARGET, screenWidth, screenHeight);
+		layer[i].valid = 0;
+		if(!layer[i].texture) {
+			// Layers get drawn straight to the screen every frame instead
+			log_msgf(WARNING, "SDL_CreateTexture: %s\n", SDL_GetError());
+			continue;
+		}
+		SDL_SetTextureBlendMode(layer[i].texture, SDL_BLENDMODE_BLEND);
+	}
+}
+
+// Plain white texture for the blocks, and the indices for two triangles
+// per quad which never change
+void graphics_create_blocks() {
+	Uint32 pixels[BLOCK_TEXTURE_SIZE * BLOCK_TEXTURE_SIZE];
+	for(int i = 0; i < BLOCK_TEXTURE_SIZE * BLOCK_TEXTURE_SIZE; i++) pixels[i] = 0xFFFFFFFF;
+	blockTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+		SDL_TEXTUREACCESS_STATIC, BLOCK_TEXTURE_SIZE, BLOCK_TEXTURE_SIZE);
+	if(!blockTexture) {
+		log_msgf(ERROR, "SDL_CreateTexture: %s\n", SDL_GetError());
+	} else {
+		SDL_UpdateTexture(blockTexture, NULL, pixels, BLOCK_TEXTURE_SIZE * 4);
+	}
+	for(int i = 0; i < MAX_QUADS; i++) {
+		int *index = &batchIndices[i * 6];
+		index[0] = i * 4; index[1] = i * 4 + 1; index[2] = i * 4 + 2;
+		index[3] = i * 4 + 2; index[4] = i * 4 + 1; index[5] = i * 4 + 3;
+	}
 }
 
 void graphics_load_font(const char *filename) {
 	font = TTF_OpenFont(filename, 18);
 	if(!font) {
 		log_msgf(ERROR, "TTF_OpenFont: %s\n", TTF_GetError());
+		return;
+	}
+	graphics_create_atlas();
+}
+
+// Renders every glyph in white, packs them into rows of one texture and
+// keeps their advance and kerning so strings never need the font again
+void graphics_create_atlas() {
+	SDL_Color white = { 255, 255, 255, 255 };
+	SDL_Surface *surfaces[GLYPH_COUNT];
+	int x = 0, y = 0, rowHeight = 0;
+	for(int i = 0; i < GLYPH_COUNT; i++) {
+		Uint16 ch = GLYPH_FIRST + i;
+		int advance = 0;
+		TTF_GlyphMetrics(font, ch, NULL, NULL, NULL, NULL, &advance);
+		glyph[i].advance = advance;
+		for(int j = 0; j < GLYPH_COUNT; j++) {
+			kerning[i][j] = TTF_GetFontKerningSizeGlyphs(font, ch, GLYPH_FIRST + j);
+		}
+		surfaces[i] = TTF_RenderGlyph_Blended(font, ch, white);
+		if(!surfaces[i]) {
+			glyph[i].rect = (SDL_Rect){ 0, 0, 0, 0 };
+			continue;
+		}
+		if(x + surfaces[i]->w > ATLAS_WIDTH) {
+			x = 0;
+			y += rowHeight;
+			rowHeight = 0;
+		}
+		glyph[i].rect = (SDL_Rect){ x, y, surfaces[i]->w, surfaces[i]->h };
+		x += surfaces[i]->w;
+		if(surfaces[i]->h > rowHeight) rowHeight = surfaces[i]->h;
+	}
+	atlasWidth = ATLAS_WIDTH;
+	atlasHeight = y + rowHeight;
+	SDL_Surface *sheet = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, atlasHeight,
+		32, SDL_PIXELFORMAT_RGBA8888);
+	if(!sheet) {
+		log_msgf(ERROR, "SDL_CreateRGBSurfaceWithFormat: %s\n", SDL_GetError());
+	}
+	for(int i = 0; i < GLYPH_COUNT; i++) {
+		if(!surfaces[i]) continue;
+		if(sheet) {
+			// Copy the alpha as it is instead of blending it onto nothing
+			SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+			SDL_BlitSurface(surfaces[i], NULL, sheet, &glyph[i].rect);
+		}
+		SDL_FreeSurface(surfaces[i]);
+	}
+	if(!sheet) return;
+	atlas = SDL_CreateTextureFromSurface(renderer, sheet);
+	SDL_FreeSurface(sheet);
+	if(!atlas) {
+		log_msgf(ERROR, "SDL_CreateTextureFromSurface: %s\n", SDL_GetError());
+		return;
+	}
+	SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+	log_msgf(TRACE, "LoadFont: %d glyphs in a %dx%d atlas.\n",
+		GLYPH_COUNT, atlasWidth, atlasHeight);
+}
+
+void graphics_capture(const char *filename, int rate) {
+	if(!capture_open(&capture, filename, screenWidth, screenHeight, rate)) return;
+	if(screen) return;
+	readback = malloc(screenWidth * screenHeight * 4);
+	if(!readback) {
+		log_msgf(ERROR, "Capture: Out of memory\n");
+		capture_close(&capture);
 	}
 }
 
-// Delete all generated text forcing them to be regenerated next frame
-void graphics_wipe_text() {
-	for(int i = 0; i < text_count; i++) {
-		SDL_DestroyTexture(text[i].texture);
+// The software renderer's surface already has the pixels, a window's
+// renderer has to copy them back first
+void graphics_capture_frame() {
+	if(screen) {
+		capture_frame(&capture, screen->pixels, screen->pitch);
+		return;
+	}
+	if(SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_RGBA32, readback,
+			screenWidth * 4) != 0) {
+		log_msgf(ERROR, "SDL_RenderReadPixels: %s\n", SDL_GetError());
+		return;
 	}
-	text_count = 0;
+	capture_frame(&capture, readback, screenWidth * 4);
 }
 
 void graphics_quit() {
+	if(capture.buffer) capture_close(&capture);
+	free(readback);
 	TTF_CloseFont(font);
-	graphics_wipe_text();
+	SDL_DestroyTexture(atlas);
+	SDL_DestroyTexture(blockTexture);
+	for(int i = 0; i < MAX_LAYERS; i++) SDL_DestroyTexture(layer[i].texture);
 	TTF_Quit();
 	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
+	if(window) SDL_DestroyWindow(window);
+	SDL_FreeSurface(screen);
 	SDL_Quit();
 }
 
 void graphics_flip() {
-	SDL_Delay(1000 / 60 - SDL_GetTicks() + frameTime);
-	frameTime = SDL_GetTicks();
+	graphics_flush_batch();
+	if(capture.buffer) graphics_capture_frame();
 	SDL_SetRenderDrawColor(renderer, 0, 192, 0, 255);
 	SDL_RenderPresent(renderer);
 	SDL_RenderClear(renderer);
@@ -69,77 +246,114 @@ void graphics_flip() {
 
 void graphics_set_color(unsigned int color) {
 	SDL_SetRenderDrawColor(renderer, color>>24, color>>16, color>>8, color);
+	textColor = (SDL_Color){ color>>24, color>>16, color>>8, color };
 }
 
-void graphics_generate_text(char *string) {
-	SDL_Color color;
-	SDL_GetRenderDrawColor(renderer, &color.r, &color.g, &color.b, &color.a);
-	SDL_Surface *surface = TTF_RenderUTF8_Blended(font, string, color);
-	if(!surface) {
-		log_msgf(ERROR, "TTF_RenderUTF8_Blended: %s\n", TTF_GetError());
-		return;
+void graphics_draw_rect(int x, int y, int w, int h) {
+	// Anything drawn after queued quads has to go over them
+	graphics_flush_batch();
+	SDL_Rect rect = { x, y, w, h };
+	SDL_RenderFillRect(renderer, &rect);
+}
+
+// Adds a quad to the batch, src is in texture coordinates from 0 to 1
+void graphics_queue_quad(SDL_Texture *texture, SDL_FRect dst, SDL_FRect src, SDL_Color c) {
+	if(texture != batchTexture || batchCount == MAX_QUADS) {
+		graphics_flush_batch();
+		batchTexture = texture;
 	}
-	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-	SDL_FreeSurface(surface);
-	if(!texture) {
-		log_msgf(ERROR, "SDL_CreateTextureFromSurface: %s\n", SDL_GetError());
-		return;
+	SDL_Vertex *v = &batchVertices[batchCount * 4];
+	v[0] = (SDL_Vertex){ { dst.x, dst.y }, c, { src.x, src.y } };
+	v[1] = (SDL_Vertex){ { dst.x + dst.w, dst.y }, c, { src.x + src.w, src.y } };
+	v[2] = (SDL_Vertex){ { dst.x, dst.y + dst.h }, c, { src.x, src.y + src.h } };
+	v[3] = (SDL_Vertex){ { dst.x + dst.w, dst.y + dst.h }, c, { src.x + src.w, src.y + src.h } };
+	batchCount++;
+}
+
+void graphics_draw_block(int x, int y, int w, int h, unsigned int color) {
+	SDL_Color c = { color>>24, color>>16, color>>8, color };
+	// Sample the middle of the texture so the edges never bleed in
+	graphics_queue_quad(blockTexture, (SDL_FRect){ x, y, w, h },
+		(SDL_FRect){ 0.5f, 0.5f, 0, 0 }, c);
+}
+
+void graphics_flush_batch() {
+	if(batchCount == 0) return;
+	if(SDL_RenderGeometry(renderer, batchTexture, batchVertices, batchCount * 4,
+			batchIndices, batchCount * 6) != 0) {
+		log_msgf(ERROR, "SDL_RenderGeometry: %s\n", SDL_GetError());
 	}
-	text[text_count].string = string;
-	text[text_count].texture = texture;
-	text_count++;
+	batchCount = 0;
 }
 
-void graphics_draw_rect(int x, int y, int w, int h) {
-	SDL_Rect rect = { x, y, w, h };
-	SDL_RenderFillRect(renderer, &rect);
+void graphics_invalidate_layer(int l) {
+	layer[l].valid = 0;
+}
+
+int graphics_begin_layer(int l) {
+	if(!layer[l].texture) return 1;
+	if(layer[l].valid) return 0;
+	graphics_flush_batch();
+	if(SDL_SetRenderTarget(renderer, layer[l].texture) != 0) {
+		log_msgf(WARNING, "SDL_SetRenderTarget: %s\n", SDL_GetError());
+		SDL_DestroyTexture(layer[l].texture);
+		layer[l].texture = NULL;
+		return 1;
+	}
+	// Start from fully transparent, keeping whatever color was set
+	Uint8 r, g, b, a;
+	SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+	SDL_RenderClear(renderer);
+	SDL_SetRenderDrawColor(renderer, r, g, b, a);
+	layer[l].valid = 1;
+	return 1;
+}
+
+void graphics_end_layer() {
+	graphics_flush_batch();
+	SDL_SetRenderTarget(renderer, NULL);
 }
 
-void graphics_draw_texture(SDL_Texture *texture, int x, int y) {
-	SDL_Rect drect = { x, y, 0, 0 };
-	SDL_QueryTexture(texture, NULL, NULL, &drect.w, &drect.h);
-	SDL_RenderCopy(renderer, texture, NULL, &drect);
+void graphics_draw_layer(int l) {
+	if(!layer[l].texture) return;
+	graphics_flush_batch();
+	SDL_RenderCopy(renderer, layer[l].texture, NULL, NULL);
 }
 
 void graphics_draw_string(char *string, int x, int y) {
-	if(strcmp(string, "") == 0) return;
-	for(int i = 0; i < text_count; i++) {
-		if(strcmp(string, text[i].string)!=0) continue;
-		graphics_draw_texture(text[i].texture, x, y);
-		return;
+	if(!atlas) return;
+	int prev = -1;
+	for(const char *c = string; *c; c++) {
+		if(*c < GLYPH_FIRST || *c > GLYPH_LAST) continue;
+		int i = *c - GLYPH_FIRST;
+		if(prev >= 0) x += kerning[prev][i];
+		SDL_Rect r = glyph[i].rect;
+		if(r.w > 0) {
+			graphics_queue_quad(atlas, (SDL_FRect){ x, y, r.w, r.h },
+				(SDL_FRect){ (float)r.x / atlasWidth, (float)r.y / atlasHeight,
+					(float)r.w / atlasWidth, (float)r.h / atlasHeight }, textColor);
+		}
+		x += glyph[i].advance;
+		prev = i;
 	}
-	// If a texture for the string doesn't exist create it
-	log_msgf(TRACE, "DrawString: Generating new texture for \"%s\".\n", string);
-	graphics_generate_text(string);
-	graphics_draw_texture(text[text_count-1].texture, x, y);
 }
 
 int graphics_string_width(char *string) {
-	if(strcmp(string, "") == 0) return 0;
-	for(int i = 0; i < text_count; i++) {
-		if(strcmp(string, text[i].string)!=0) continue;
-		int width;
-		SDL_QueryTexture(text[i].texture, NULL, NULL, &width, NULL);
-		return width;
+	int width = 0, prev = -1;
+	for(const char *c = string; *c; c++) {
+		if(*c < GLYPH_FIRST || *c > GLYPH_LAST) continue;
+		int i = *c - GLYPH_FIRST;
+		if(prev >= 0) width += kerning[prev][i];
+		width += glyph[i].advance;
+		prev = i;
 	}
-	return 0;
+	return width;
 }
 
+// Right aligned so the last digit ends at x
 void graphics_draw_int(int n, int x, int y) {
-	do {
-		x -= 12;
-		switch(n % 10) {
-			case 0: graphics_draw_string("0", x, y); break;
-			case 1: graphics_draw_string("1", x, y); break;
-			case 2: graphics_draw_string("2", x, y); break;
-			case 3: graphics_draw_string("3", x, y); break;
-			case 4: graphics_draw_string("4", x, y); break;
-			case 5: graphics_draw_string("5", x, y); break;
-			case 6: graphics_draw_string("6", x, y); break;
-			case 7: graphics_draw_string("7", x, y); break;
-			case 8: graphics_draw_string("8", x, y); break;
-			case 9: graphics_draw_string("9", x, y); break;
-		}
-		n /= 10;
-	} while(n > 0);
+	char digits[12];
+	snprintf(digits, sizeof(digits), "%d", n);
+	graphics_draw_string(digits, x - graphics_string_width(digits), y);
 }
@@ -12,18 +12,58 @@
 #define COLOR_WHITE  0xFFFFFFFF
 #define COLOR_SHADOW 0x606060FF
 
-void graphics_init(int x, int y);
+// Layers cache things that rarely change in screen sized textures, so they
+// only have to be drawn again after being invalidated
+#define LAYER_CHROME 0 // Backgrounds and labels
+#define LAYER_STAGE 1  // Locked blocks, queue and hold
+#define MAX_LAYERS 2
+
+// With vsync the renderer waits for the display when flipping
+void graphics_init(int x, int y, int vsync);
+
+// Draws into memory with SDL's software renderer instead, no window, video
+// driver or GPU needed
+void graphics_init_offscreen(int x, int y);
+
+// Writes every frame flipped from now on to filename, as raw RGBA (.rgba),
+// y4m video (.y4m) or numbered PNGs (a %d in the name). Works with a
+// window too, at the cost of reading each frame back
+void graphics_capture(const char *filename, int rate);
 
 void graphics_load_font(const char *filename);
 
 void graphics_quit();
 
+// Shows the frame, only waits if vsync is on
 void graphics_flip();
 
 void graphics_set_color(unsigned int color);
 
 void graphics_draw_rect(int x, int y, int w, int h);
 
+// Queues a solid block. Blocks and text are batched, everything queued
+// from the same texture is drawn with a single SDL_RenderGeometry call the
+// next time something else is drawn or the screen flips
+void graphics_draw_block(int x, int y, int w, int h, unsigned int color);
+
+// Draws the queued blocks and text now
+void graphics_flush_batch();
+
+// Makes the layer get drawn again the next time graphics_begin_layer is called
+void graphics_invalidate_layer(int layer);
+
+// Returns true if the layer needs to be drawn, in which case everything up
+// to graphics_end_layer is drawn into it. Without render target support
+// this always returns true and the drawing goes straight to the screen
+int graphics_begin_layer(int layer);
+
+void graphics_end_layer();
+
+// Copies the layer to the screen
+void graphics_draw_layer(int layer);
+
+// Text is drawn in the last color set, from glyphs graphics_load_font
+// rendered up front. Only printable ASCII, anything else is skipped
 void graphics_draw_string(char *string, int x, int y);
 
 int graphics_string_width(char *string);
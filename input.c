@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "input.h"
 
 const int K_LEFT   = SDL_SCANCODE_LEFT;
@@ -10,11 +12,52 @@ const int K_SHIFT  = SDL_SCANCODE_LSHIFT;
 const int K_SPACE  = SDL_SCANCODE_SPACE;
 const int K_RETURN = SDL_SCANCODE_RETURN;
 const int K_ESC    = SDL_SCANCODE_ESCAPE;
+const int K_F3     = SDL_SCANCODE_F3;
+
+// Keys the game sees, in the same order as the InputBits
+const int GameKeys[] = {
+	SDL_SCANCODE_UP, SDL_SCANCODE_DOWN, SDL_SCANCODE_LEFT, SDL_SCANCODE_RIGHT,
+	SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_LSHIFT, SDL_SCANCODE_SPACE,
+	SDL_SCANCODE_RETURN, SDL_SCANCODE_ESCAPE
+};
+#define GAME_KEY_COUNT (sizeof(GameKeys) / sizeof(GameKeys[0]))
+
+// Game key events not taken by input_events yet, with their SDL timestamps.
+// Presses stop being queued while only room for a release of every game key
+// is left, so a key the game sees go down always gets to come back up
+#define EVENT_QUEUE 64
+struct { InputBits key; bool down; Uint32 time; } EventQueue[EVENT_QUEUE];
+int eventsQueued = 0;
+// Keys held once everything queued so far has been taken
+InputBits queuedKeys = 0;
+
+KeyState key, oldKey;
+Uint32 firstPress = 0;
+
+// Queues a key event if it's one the game cares about
+void queue_key(SDL_KeyboardEvent *event) {
+	if(event->repeat) return;
+	for(int i = 0; i < GAME_KEY_COUNT; i++) {
+		if(event->keysym.scancode != GameKeys[i]) continue;
+		bool down = event->type == SDL_KEYDOWN;
+		// A release whose press was left out is left out too
+		if(down == ((queuedKeys >> i) & 1)) return;
+		if(down && eventsQueued >= EVENT_QUEUE - GAME_KEY_COUNT) return;
+		if(down && !firstPress) firstPress = event->timestamp ? event->timestamp : 1;
+		queuedKeys ^= 1 << i;
+		EventQueue[eventsQueued].key = 1 << i;
+		EventQueue[eventsQueued].down = down;
+		EventQueue[eventsQueued].time = event->timestamp;
+		eventsQueued++;
+		return;
+	}
+}
 
 int input_update() {
 	SDL_Event event;
 	while(SDL_PollEvent(&event)) {
 		if(event.type == SDL_QUIT) return 1;
+		if(event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) queue_key(&event.key);
 	}
 	oldKey.left = key.left;
 	oldKey.right = key.right;
@@ -26,6 +69,7 @@ int input_update() {
 	oldKey.space = key.space;
 	oldKey.enter = key.enter;
 	oldKey.esc = key.esc;
+	oldKey.f3 = key.f3;
 	const Uint8 *state = SDL_GetKeyboardState(NULL);
 	key.up = state[K_UP];
 	key.down = state[K_DOWN];
@@ -37,5 +81,24 @@ int input_update() {
 	key.space = state[K_SPACE];
 	key.enter = state[K_RETURN];
 	key.esc = state[K_ESC];
+	key.f3 = state[K_F3];
 	return 0;
 }
+
+int input_events(InputEvent *out, int max, Uint32 start, Uint32 end) {
+	int count = eventsQueued < max ? eventsQueued : max;
+	Uint32 length = end > start ? end - start : 1;
+	for(int i = 0; i < count; i++) {
+		// Where in the update the event lands, keeping their spacing
+		Uint32 offset = EventQueue[i].time > start ? EventQueue[i].time - start : 0;
+		Uint64 time = (Uint64)offset * FRAME_US / length;
+		out[i].key = EventQueue[i].key;
+		out[i].down = EventQueue[i].down;
+		out[i].time = time < FRAME_US ? time : FRAME_US - 1;
+		// Times only go forward, even when a late event was left over
+		if(i > 0 && out[i].time < out[i - 1].time) out[i].time = out[i - 1].time;
+	}
+	eventsQueued -= count;
+	memmove(EventQueue, EventQueue + count, eventsQueued * sizeof(EventQueue[0]));
+	return count;
+}
@@ -3,15 +3,28 @@
 
 #include <SDL2/SDL.h>
 
+#include "game.h"
+
 // A couple structs that contain key/mouse button status
 // There is a "current" state and an "old" state (previous frame)
-struct {
+typedef struct {
 	Uint8 up; Uint8 down; Uint8 left; Uint8 right;
 	Uint8 z; Uint8 x; Uint8 shift; Uint8 space; Uint8 enter; Uint8 esc;
-} key, oldKey;
+	Uint8 f3;
+} KeyState;
+
+extern KeyState key, oldKey;
+
+// SDL_GetTicks of the earliest key press that hasn't been shown yet, 0 when
+// there isn't one. Whoever presents the frame clears it
+extern Uint32 firstPress;
 
 // Updates the input structs to new values, and also handles SDL events
 int input_update();
 
-#endif
+// Takes up to max of the game key presses and releases that happened between
+// SDL_GetTicks start and end, with their times spread over one update.
+// Anything past max is left for the next call
+int input_events(InputEvent *out, int max, Uint32 start, Uint32 end);
 
+#endif
@@ -1,6 +1,18 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "logsys.h"
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <time.h>
+
+// Messages waiting to be written, has to be a power of 2
+#define LOG_RING_SIZE 256
+// Longest message kept, anything past it is cut off
+#define LOG_TEXT_SIZE 256
+// How long the writer sleeps when there is nothing to write
+#define LOG_POLL_MS 5
 
 int logLevel = TRACE;
 
@@ -16,17 +28,77 @@ char *levelStr[7] = {
 	"[FATAL]"
 };
 
+// One queued message. sequence says whose turn the slot is: equal to the
+// queue position when free for the producer claiming it, one past it once
+// the message is ready for the writer
+typedef struct {
+	_Atomic unsigned sequence;
+	int level;
+	char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+LogRecord ring[LOG_RING_SIZE];
+// Next position to claim, shared by every thread that logs
+_Atomic unsigned ringHead;
+// Next position to write, only the writer thread touches it
+unsigned ringTail;
+// Messages thrown away because the ring was full
+_Atomic unsigned dropped;
+
+pthread_t writer;
+atomic_int writing;
+
+// Writes out everything queued so far, returns how many messages that was
+static int log_drain() {
+	int count = 0;
+	for(;; ringTail++, count++) {
+		LogRecord *r = &ring[ringTail & (LOG_RING_SIZE - 1)];
+		unsigned seq = atomic_load_explicit(&r->sequence, memory_order_acquire);
+		if((int)(seq - (ringTail + 1)) < 0) break;
+		fprintf(logfile, "%s %s", levelStr[r->level], r->text);
+		// Hand the slot back for the next time round the ring
+		atomic_store_explicit(&r->sequence, ringTail + LOG_RING_SIZE, memory_order_release);
+	}
+	unsigned lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+	if(lost > 0) fprintf(logfile, "%s %u log messages dropped.\n", levelStr[WARNING], lost);
+	if(count > 0 || lost > 0) fflush(logfile);
+	return count;
+}
+
+static void *log_writer(void *arg) {
+	struct timespec poll = { 0, LOG_POLL_MS * 1000000L };
+	while(atomic_load(&writing)) {
+		if(log_drain() == 0) nanosleep(&poll, NULL);
+	}
+	log_drain();
+	return NULL;
+}
+
 void log_open(const char *filename) {
 	logfile = fopen(filename, "w");
 	if(logfile == NULL) {
 		log_msgf(ERROR, "Unable to create log \"%s\".\n", filename);
+		return;
+	}
+	for(unsigned i = 0; i < LOG_RING_SIZE; i++) atomic_init(&ring[i].sequence, i);
+	atomic_init(&ringHead, 0);
+	ringTail = 0;
+	atomic_store(&writing, 1);
+	if(pthread_create(&writer, NULL, log_writer, NULL) != 0) {
+		// Nothing to write it, give up on logging rather than fill the ring
+		atomic_store(&writing, 0);
+		fclose(logfile);
+		logfile = NULL;
 	}
 }
 
 void log_close() {
 	if(logfile == NULL) return;
 	log_msgf(DEBUG, "Closing log file.\n");
+	atomic_store(&writing, 0);
+	pthread_join(writer, NULL);
 	fclose(logfile);
+	logfile = NULL;
 }
 /*
 void log_msg(int level, const char *msg) {
@@ -34,11 +106,36 @@ void log_msg(int level, const char *msg) {
 	fprintf(logfile, "%s %s", levelStr[level], msg);
 }
 */
-void log_msgf(int level, const char *format, ...) {
-	if(logfile == NULL || logLevel > level) return;
-	fprintf(logfile, "%s ", levelStr[level]);
+void log_write(int level, const char *format, ...) {
+	if(logfile == NULL || !atomic_load_explicit(&writing, memory_order_relaxed)) return;
+	// Claim a slot, bounded queue after Dmitry Vyukov's
+	unsigned pos = atomic_load_explicit(&ringHead, memory_order_relaxed);
+	LogRecord *r;
+	for(;;) {
+		r = &ring[pos & (LOG_RING_SIZE - 1)];
+		unsigned seq = atomic_load_explicit(&r->sequence, memory_order_acquire);
+		int diff = (int)(seq - pos);
+		if(diff == 0) {
+			if(atomic_compare_exchange_weak_explicit(&ringHead, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed)) break;
+		} else if(diff < 0) {
+			// Full, the writer is behind. Never wait for it
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&ringHead, memory_order_relaxed);
+		}
+	}
+	r->level = level;
 	va_list args;
 	va_start(args, format);
-	vfprintf(logfile, format, args);
+	vsnprintf(r->text, LOG_TEXT_SIZE, format, args);
 	va_end(args);
+	atomic_store_explicit(&r->sequence, pos + 1, memory_order_release);
+	if(level == FATAL) {
+		// About to crash, wait until it's on disk
+		struct timespec poll = { 0, 1000000L };
+		while(atomic_load_explicit(&r->sequence, memory_order_acquire) == pos + 1 &&
+			atomic_load(&writing)) nanosleep(&poll, NULL);
+	}
 }
@@ -14,16 +14,36 @@ enum {
 	FATAL    // Crash
 };
 
-// Opens a log file to write to
+// Messages below this level are compiled out, arguments and all.
+// Release builds (NDEBUG) drop TRACE and DEBUG
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL INFO
+#else
+#define LOG_COMPILE_LEVEL ALL
+#endif
+#endif
+
+// Messages below this level are skipped at runtime
+extern int logLevel;
+
+// Opens a log file to write to, and starts the thread that writes to it
 void log_open(const char *filename);
 
-// Closes log file if one is open
+// Writes out everything still queued, stops the thread and closes the file
 void log_close();
 
 // Log simple message
 //void log_msg(int level, const char *msg);
 
-// Log with formatting, syntax like fprintf
-void log_msgf(int level, const char *format, ...);
+// Log with formatting, syntax like fprintf. The message is formatted on
+// the calling thread and queued, the file is written by a background
+// thread so this never waits on disk
+#define log_msgf(level, ...) do { \
+	if((level) >= LOG_COMPILE_LEVEL && (level) >= logLevel) log_write(level, __VA_ARGS__); \
+} while(0)
+
+// What log_msgf calls, without the level checks
+void log_write(int level, const char *format, ...);
 
 #endif
@@ -0,0 +1,472 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "perfect.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "logsys.h"
+
+#define MAX_THREADS 64
+// Positions a thread searches between looks at the clock
+#define CLOCK_EVERY 256
+// Nothing there, for an empty hold or once the queue has run out
+#define NO_PIECE 0xFF
+// Rows a piece's grid can be at, from wholly above the rows being cleared
+// down to its top row being their bottom one
+#define GRID_ROWS (PC_MAX_LINES + 4)
+// Room for every place one piece can lock
+#define MAX_MOVES (4 * GRID_ROWS * (MAX_STAGE_W + 3))
+// The search is split into at least this many jobs a thread, so one that
+// draws a big one doesn't leave the others waiting
+#define JOBS_PER_THREAD 8
+
+// PieceDB order
+enum { PIECE_O, PIECE_I, PIECE_L, PIECE_J, PIECE_S, PIECE_Z, PIECE_T };
+
+// The bottom rows of the stage that still have to clear, everything above
+// them is empty, and the pieces left to do it with
+typedef struct {
+	// Top row first, only the first lines are used
+	Row rows[PC_MAX_LINES];
+	// Row of the stage as it is now each one started out as
+	Uint8 origin[PC_MAX_LINES];
+	// Rows left, and rows there were to begin with
+	Uint8 lines, total;
+	// Piece to place and the held one, NO_PIECE when there isn't one, and
+	// how many queue pieces have been taken
+	Uint8 current, hold, taken;
+	bool canHold;
+} Node;
+
+// A position to search from and the pieces that led to it
+typedef struct {
+	Node node;
+	PcStep path[PC_MAX_PIECES];
+	int depth;
+} Job;
+
+typedef struct {
+	int width, height;
+	Row full;
+	Uint8 queue[5];
+	TransTable *table;
+	PcResult *out;
+	Job *jobs;
+	int jobCount, jobMax;
+	atomic_int nextJob;
+	// Solutions written to out so far, counting those that didn't fit
+	atomic_int stored;
+	atomic_bool stop;
+	Uint64 deadline;
+} Solver;
+
+typedef struct {
+	_Alignas(64) Solver *solver;
+	PcStep path[PC_MAX_PIECES];
+	// Positions at this depth are added to the solver's jobs instead of
+	// being searched, 0 searches everything
+	int split;
+	Uint64 nodes, found;
+	TransStats stats;
+} Worker;
+
+// Lowest flip covering the same blocks as each flip, and how far its grid
+// is from this one's. Placements are only listed for the lowest flip, so
+// the same blocks aren't searched twice
+typedef struct {
+	Sint8 flip, dx, dy;
+} SameFlip;
+
+static SameFlip Same[7][4];
+static pthread_once_t SameOnce = PTHREAD_ONCE_INIT;
+
+static void find_same_flips() {
+	for(int t = 0; t < 7; t++) for(int f = 0; f < 4; f++) {
+		const PieceShape *a = &PieceShapes[t][f];
+		Same[t][f] = (SameFlip){ f, 0, 0 };
+		for(int c = 0; c < f; c++) {
+			const PieceShape *b = &PieceShapes[t][c];
+			if(a->maxY - a->minY != b->maxY - b->minY) continue;
+			bool same = true;
+			for(int y = 0; y <= a->maxY - a->minY; y++) {
+				same &= a->rows[a->minY + y] >> a->minX == b->rows[b->minY + y] >> b->minX;
+			}
+			if(!same) continue;
+			Same[t][f] = (SameFlip){ c, a->minX - b->minX, a->minY - b->minY };
+			break;
+		}
+	}
+}
+
+// Spreads the set bits of r over the runs of set bits in open they're in,
+// both ways at once a doubling step at a time
+static Uint32 slide(Uint32 r, Uint32 open) {
+	Uint32 left = open, right = open;
+	r |= ((r << 1) & left) | ((r >> 1) & right);
+	left &= left << 1; right &= right >> 1;
+	r |= ((r << 2) & left) | ((r >> 2) & right);
+	left &= left << 2; right &= right >> 2;
+	r |= ((r << 4) & left) | ((r >> 4) & right);
+	left &= left << 4; right &= right >> 4;
+	r |= ((r << 8) & left) | ((r >> 8) & right);
+	left &= left << 8; right &= right >> 8;
+	r |= ((r << 16) & left) | ((r >> 16) & right);
+	return r;
+}
+
+// Every place a piece of type can lock in the rows of n, with the same
+// moves the game has, found for all columns of a row at once. Bit x + 3 of
+// a mask is the piece's grid at column x, so it can hang off the left
+// wall. The piece starts wholly above the rows, anywhere it fits: from
+// where it spawns it can get to any of those
+static int placements(const Solver *s, const Node *n, int type, Piece *out) {
+	int rows = n->lines + 4;
+	Uint32 wall = ~((Uint32)s->full << 3), columns = (1u << (s->width + 3)) - 1;
+	// The rows with walls, 4 empty ones above them and the floor below
+	Uint32 pad[GRID_ROWS + 4];
+	for(int i = 0; i < 4; i++) pad[i] = wall;
+	for(int i = 0; i < n->lines; i++) pad[4 + i] = wall | (Uint32)n->rows[i] << 3;
+	for(int i = rows; i < rows + 4; i++) pad[i] = ~0u;
+	// Columns each flip fits at in each row, and can get to
+	Uint32 fit[4][GRID_ROWS + 1], reach[4][GRID_ROWS + 1];
+	for(int f = 0; f < 4; f++) {
+		const PieceShape *p = &PieceShapes[type][f];
+		for(int y = 0; y < rows; y++) {
+			Uint32 hit = 0;
+			for(int i = 0; i < 4; i++) hit |= pad[y + p->cells[i].y] >> p->cells[i].x;
+			fit[f][y] = ~hit & columns;
+			reach[f][y] = 0;
+		}
+		fit[f][rows] = 0;
+		reach[f][0] = fit[f][0];
+	}
+	// Rows are gone through top down. The flips of a row turn into each
+	// other until none of them gets anywhere new, then they all fall into
+	// the next row. A kick up goes back a row
+	for(int y = 0; y < rows; ) {
+		bool kicked = false;
+		int dirty = 0;
+		for(int f = 0; f < 4; f++) dirty |= (reach[f][y] != 0) << f;
+		while(dirty) {
+			int f = __builtin_ctz(dirty);
+			dirty &= dirty - 1;
+			Uint32 r = reach[f][y] = slide(reach[f][y], fit[f][y]);
+			// Turning either way, then the kicks left, right and up in the
+			// order wall_kick tries them
+			for(int turn = 1; turn <= 3; turn += 2) {
+				int g = (f + turn) & 3;
+				Uint32 to = fit[g][y], moved = r & to, rest = r & ~to;
+				moved |= (rest >> 1) & to;
+				rest &= ~(to << 1);
+				moved |= (rest << 1) & to;
+				rest &= ~(to >> 1);
+				if(moved & ~reach[g][y]) {
+					reach[g][y] |= moved;
+					dirty |= 1 << g;
+				}
+				if(y > 0 && (rest & fit[g][y - 1] & ~reach[g][y - 1])) {
+					reach[g][y - 1] |= rest & fit[g][y - 1];
+					kicked = true;
+				}
+			}
+		}
+		for(int f = 0; f < 4; f++) reach[f][y + 1] |= reach[f][y] & fit[f][y + 1];
+		y += kicked ? -1 : 1;
+	}
+	// Where each can't fall any further, with every block inside the rows
+	Uint32 rest[4][GRID_ROWS] = {{ 0 }};
+	for(int f = 0; f < 4; f++) {
+		SameFlip same = Same[type][f];
+		for(int y = 4 - PieceShapes[type][f].minY; y < rows; y++) {
+			Uint32 r = reach[f][y] & ~fit[f][y + 1];
+			rest[same.flip][y + same.dy] |= same.dx >= 0 ? r << same.dx : r >> -same.dx;
+		}
+	}
+	int count = 0;
+	for(int f = 0; f < 4; f++) for(int y = 0; y < rows; y++) {
+		for(Uint32 r = rest[f][y]; r; r &= r - 1) {
+			out[count++] = (Piece){ __builtin_ctz(r) - 3, y - 4, type, f };
+		}
+	}
+	return count;
+}
+
+// Locks p into the rows and takes out the ones it fills
+static void place(const Solver *s, Node *n, Piece p) {
+	const PieceShape *shape = &PieceShapes[p.type][p.flip];
+	for(int y = shape->minY; y <= shape->maxY; y++) {
+		Row r = shape->rows[y];
+		n->rows[p.y + y] |= p.x >= 0 ? r << p.x : r >> -p.x;
+	}
+	int kept = 0;
+	for(int y = 0; y < n->lines; y++) {
+		if(n->rows[y] == s->full) continue;
+		n->rows[kept] = n->rows[y];
+		n->origin[kept] = n->origin[y];
+		kept++;
+	}
+	n->lines = kept;
+}
+
+// Quick tests that rule out any perfect clear from n. None of them ever
+// rules out one that exists, they only save searching for it
+static bool viable(const Solver *s, const Node *n) {
+	int pieces = 0, counts[7] = { 0 };
+	if(n->current != NO_PIECE) counts[n->current]++, pieces++;
+	if(n->hold != NO_PIECE) counts[n->hold]++, pieces++;
+	for(int i = n->taken; i < 5; i++) counts[s->queue[i]]++, pieces++;
+	// Empty cells in each column, and columns with an empty cell next to
+	// one in the column to their right
+	int empty = 0, column[MAX_STAGE_W] = { 0 };
+	Row joined = 0;
+	for(int y = 0; y < n->lines; y++) {
+		Row e = ~n->rows[y] & s->full;
+		joined |= e & (e >> 1);
+		for(; e; e &= e - 1) column[__builtin_ctz(e)]++;
+	}
+	// Columns joined that way are one region, and a piece can't lie in two.
+	// Every empty cell of a column counts as joined to the others, rows
+	// between them may clear. Each region needs a whole number of pieces
+	int region = 0, parity = 0;
+	for(int x = 0; x < s->width; x++) {
+		empty += column[x];
+		region += column[x];
+		parity += x & 1 ? -column[x] : column[x];
+		if(!(joined >> x & 1)) {
+			if(region % 4) return false;
+			region = 0;
+		}
+	}
+	if(empty > pieces * 4) return false;
+	// Empty cells in even columns less those in odd ones, which only pieces
+	// change since a row clears with nothing empty in it. O, S, Z and a
+	// flat I fill as many of each, a standing I changes it by 4 and L, J
+	// and T by 2
+	int lj = counts[PIECE_L] + counts[PIECE_J];
+	if(abs(parity) > 4 * counts[PIECE_I] + 2 * (lj + counts[PIECE_T])) return false;
+	// With no T and every piece needed, the L and J settle it mod 4
+	if(!counts[PIECE_T] && empty == pieces * 4 && (parity - 2 * lj) % 4) return false;
+	return true;
+}
+
+static Uint64 mix(Uint64 h, Uint64 v) {
+	h = (h ^ v) * 0x9E3779B97F4A7C15ull;
+	return h ^ h >> 32;
+}
+
+// Everything a perfect clear from n depends on, so the same position
+// reached from another stage or game shares the key
+static Uint64 node_key(const Solver *s, const Node *n) {
+	Uint64 h = mix(s->width, n->lines);
+	for(int y = 0; y < n->lines; y++) h = mix(h, n->rows[y]);
+	h = mix(h, n->current | n->hold << 8 | n->canHold << 16 | (5 - n->taken) << 24);
+	for(int i = n->taken; i < 5; i++) h = mix(h, s->queue[i]);
+	return h ? h : 1;
+}
+
+static void solved(Worker *w, const Node *n, int count) {
+	Solver *s = w->solver;
+	w->found++;
+	int i = atomic_fetch_add(&s->stored, 1);
+	if(i >= PC_MAX_SOLUTIONS) return;
+	PcSolution *sol = &s->out->solutions[i];
+	memcpy(sol->steps, w->path, count * sizeof(PcStep));
+	sol->count = count;
+	sol->lines = n->total;
+}
+
+static void add_job(Worker *w, const Node *n, int depth) {
+	Solver *s = w->solver;
+	if(s->jobCount == s->jobMax) {
+		int max = s->jobMax ? s->jobMax * 2 : 256;
+		Job *jobs = realloc(s->jobs, max * sizeof(Job));
+		if(!jobs) {
+			log_msgf(ERROR, "Out of memory splitting the perfect clear search.\n");
+			atomic_store(&s->stop, true);
+			return;
+		}
+		s->jobs = jobs;
+		s->jobMax = max;
+	}
+	Job *j = &s->jobs[s->jobCount++];
+	j->node = *n;
+	memcpy(j->path, w->path, depth * sizeof(PcStep));
+	j->depth = depth;
+}
+
+static int search(Worker *w, const Node *n, int depth);
+
+// Locks the current piece everywhere it goes, or with hold the held one (or
+// the next if nothing is held), and searches on from each. Returns how many
+// of those might still lead to a perfect clear
+static int try_piece(Worker *w, const Node *n, int depth, bool hold) {
+	Solver *s = w->solver;
+	Node next = *n;
+	int type = n->current;
+	if(hold) {
+		type = n->hold != NO_PIECE ? n->hold : s->queue[next.taken++];
+		next.hold = n->current;
+	}
+	next.current = next.taken < 5 ? s->queue[next.taken++] : NO_PIECE;
+	next.canHold = true;
+	Piece moves[MAX_MOVES];
+	int count = placements(s, n, type, moves), open = 0;
+	PcStep *step = &w->path[depth];
+	for(int i = 0; i < count; i++) {
+		Piece p = moves[i];
+		const PieceShape *shape = &PieceShapes[type][p.flip];
+		step->piece = p;
+		step->piece.y += s->height - n->lines;
+		step->hold = hold;
+		for(int c = 0; c < 4; c++) {
+			step->cells[c].x = p.x + shape->cells[c].x;
+			step->cells[c].y = n->origin[p.y + shape->cells[c].y];
+		}
+		Node child = next;
+		place(s, &child, p);
+		// Clearing every block with empty rows left over is a perfect clear
+		// in fewer rows, the search for that many finds it
+		Row left = 0;
+		for(int y = 0; y < child.lines; y++) left |= child.rows[y];
+		if(!child.lines) {
+			solved(w, &child, depth + 1);
+			open++;
+		} else if(!left || !viable(s, &child)) {
+			continue;
+		} else if(depth + 1 == w->split) {
+			add_job(w, &child, depth + 1);
+			open++;
+		} else {
+			open += search(w, &child, depth + 1);
+		}
+		if(atomic_load_explicit(&s->stop, memory_order_relaxed)) break;
+	}
+	return open;
+}
+
+static int search(Worker *w, const Node *n, int depth) {
+	Solver *s = w->solver;
+	if(++w->nodes % CLOCK_EVERY == 0 && now_ns() > s->deadline) atomic_store(&s->stop, true);
+	if(atomic_load_explicit(&s->stop, memory_order_relaxed)) return 0;
+	Uint64 key = 0;
+	int unused;
+	if(s->table) {
+		key = node_key(s, n);
+		if(trans_probe(s->table, key, &unused, &w->stats)) return 0;
+	}
+	if(n->current == NO_PIECE) return 0;
+	int open = try_piece(w, n, depth, false);
+	// Swapping for a held piece of the same type changes nothing
+	if(n->canHold && (n->hold == NO_PIECE ? n->taken < 5 : n->hold != n->current)) {
+		open += try_piece(w, n, depth, true);
+	}
+	// Only a search that went all the way proves there's nothing
+	if(!open && s->table && !atomic_load(&s->stop)) trans_store(s->table, key, 0, &w->stats);
+	return open;
+}
+
+// Replaces the jobs with the positions one piece on from each
+static void split_jobs(Solver *s, Worker *w) {
+	Job *jobs = s->jobs;
+	int count = s->jobCount;
+	s->jobs = NULL;
+	s->jobCount = s->jobMax = 0;
+	for(int i = 0; i < count; i++) {
+		memcpy(w->path, jobs[i].path, jobs[i].depth * sizeof(PcStep));
+		w->split = jobs[i].depth + 1;
+		search(w, &jobs[i].node, jobs[i].depth);
+	}
+	w->split = 0;
+	free(jobs);
+}
+
+static void *worker_main(void *arg) {
+	Worker *w = arg;
+	Solver *s = w->solver;
+	int i;
+	while(!atomic_load(&s->stop) && (i = atomic_fetch_add(&s->nextJob, 1)) < s->jobCount) {
+		Job *j = &s->jobs[i];
+		memcpy(w->path, j->path, j->depth * sizeof(PcStep));
+		search(w, &j->node, j->depth);
+	}
+	return NULL;
+}
+
+static int compare_solutions(const void *a, const void *b) {
+	const PcSolution *x = a, *y = b;
+	if(x->count != y->count) return x->count - y->count;
+	return memcmp(x->steps, y->steps, sizeof(x->steps));
+}
+
+void pc_solve(const GameState *g, int threads, int budget, TransTable *table, PcResult *out) {
+	Uint64 start = now_ns();
+	pthread_once(&SameOnce, find_same_flips);
+	memset(out, 0, sizeof(*out));
+	out->stageChanges = g->stageChanges;
+	// Nothing to search once the game is over
+	if(g->mode != MODE_STAGE) {
+		out->complete = true;
+		return;
+	}
+	const Stage *st = &g->stage;
+	Solver s = {
+		.width = st->size.width, .height = st->size.height, .full = st->full,
+		.table = table, .out = out, .deadline = start + (Uint64)budget * 1000
+	};
+	atomic_init(&s.nextJob, 0);
+	atomic_init(&s.stored, 0);
+	atomic_init(&s.stop, false);
+	for(int i = 0; i < 5; i++) s.queue[i] = g->queue[i].type;
+	if(threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads < 1) threads = 1;
+	if(threads > MAX_THREADS) threads = MAX_THREADS;
+	Worker workers[MAX_THREADS];
+	for(int i = 0; i < threads; i++) workers[i] = (Worker){ .solver = &s };
+	// A search from each number of rows the stage could clear in. The
+	// current piece has to get over all of them from where it spawns, and
+	// from where a held piece comes back in
+	int top = 0;
+	while(top < s.height && !st->rows[top]) top++;
+	int most = s.height - st->size.hidden - 4;
+	if(most > PC_MAX_LINES) most = PC_MAX_LINES;
+	for(int lines = s.height - top > 0 ? s.height - top : 1; lines <= most; lines++) {
+		Node n = {
+			.lines = lines, .total = lines, .current = g->piece.type,
+			.hold = g->heldSomething ? g->hold.type : NO_PIECE, .canHold = !g->holded
+		};
+		for(int y = 0; y < lines; y++) {
+			n.rows[y] = st->rows[s.height - lines + y];
+			n.origin[y] = s.height - lines + y;
+		}
+		if(viable(&s, &n)) add_job(&workers[0], &n, 0);
+	}
+	// Deep enough that every thread has plenty to take from
+	for(int depth = 0; depth < 2 && threads > 1 && s.jobCount
+			&& s.jobCount < threads * JOBS_PER_THREAD; depth++) {
+		split_jobs(&s, &workers[0]);
+	}
+	if(threads > s.jobCount) threads = s.jobCount > 0 ? s.jobCount : 1;
+	pthread_t ids[MAX_THREADS];
+	int started = 1;
+	for(; started < threads; started++) {
+		if(pthread_create(&ids[started], NULL, worker_main, &workers[started])) break;
+	}
+	worker_main(&workers[0]);
+	for(int i = 1; i < started; i++) pthread_join(ids[i], NULL);
+	free(s.jobs);
+	for(int i = 0; i < threads; i++) {
+		out->nodes += workers[i].nodes;
+		out->found += workers[i].found;
+		if(table) trans_add_stats(table, &workers[i].stats);
+	}
+	out->count = atomic_load(&s.stored);
+	if(out->count > PC_MAX_SOLUTIONS) out->count = PC_MAX_SOLUTIONS;
+	qsort(out->solutions, out->count, sizeof(PcSolution), compare_solutions);
+	out->complete = !atomic_load(&s.stop);
+	out->micros = (now_ns() - start) / 1000;
+}
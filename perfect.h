@@ -0,0 +1,63 @@
+#ifndef TETRIS_PERFECT
+#define TETRIS_PERFECT
+
+#include "game.h"
+#include "trans.h"
+
+// Finds every way the pieces the player can already see clear the stage
+// completely: the current piece, the hold and the queue. Only stages whose
+// blocks all sit in the bottom few rows can have one
+
+// Most rows a perfect clear is looked for in
+#define PC_MAX_LINES 6
+// The current piece, the hold and the whole queue
+#define PC_MAX_PIECES 7
+// Solutions a PcResult keeps, any more are only counted
+#define PC_MAX_SOLUTIONS 64
+// Time the coaching hint gets, a frame at 60 updates a second is a little
+// under 17ms and drawing needs the rest
+#define PC_BUDGET_US 8000
+// Positions with no perfect clear a coaching table remembers, as 1 << bits
+#define PC_TABLE_BITS 18
+
+// One piece of a solution
+typedef struct {
+	// Where it locks, on the stage as it will be by then with the rows
+	// cleared by the pieces before it gone
+	Piece piece;
+	// Whether the hold is pressed first, to play the held piece (or the
+	// next one if nothing is held yet) and keep the current one
+	bool hold;
+	// Its blocks on the stage as it is now, which is where a hint draws them
+	struct { Sint8 x, y; } cells[4];
+} PcStep;
+
+typedef struct {
+	PcStep steps[PC_MAX_PIECES];
+	// Pieces placed, and rows the stage was cleared in
+	Uint8 count, lines;
+} PcSolution;
+
+typedef struct {
+	// Fewest pieces first, the rest in an order that doesn't depend on
+	// which thread found them first
+	PcSolution solutions[PC_MAX_SOLUTIONS];
+	int count;
+	// Every solution found, counting those that didn't fit
+	Uint64 found;
+	// Positions searched, and how long it took
+	Uint64 nodes, micros;
+	// False when the time ran out before every position was searched
+	bool complete;
+	// stageChanges of the game it was solved for, a hint is stale once the
+	// game has moved on
+	Uint32 stageChanges;
+} PcResult;
+
+// Searches g for perfect clears on threads threads, one per core if 0 or
+// less, and stops after budget microseconds. Positions found to have none
+// are kept in table and never searched again, by this call or any later
+// one whatever game they come up in. table may be NULL
+void pc_solve(const GameState *g, int threads, int budget, TransTable *table, PcResult *out);
+
+#endif
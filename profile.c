@@ -0,0 +1,68 @@
+#include "profile.h"
+
+#include <stdio.h>
+
+#include "logsys.h"
+
+const char *PhaseNames[PHASE_COUNT] = {
+	"input", "update", "draw", "present", "frame", "latency"
+};
+
+Histogram PhaseTimes[PHASE_COUNT];
+
+static int bucket_index(Uint32 us) {
+	if(us < HISTOGRAM_LINEAR) return us;
+	int e = 31 - __builtin_clz(us);
+	int sub = (us >> (e - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+	return HISTOGRAM_LINEAR + ((e - 5) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+// Largest duration that goes in the bucket
+static Uint32 bucket_top(int i) {
+	if(i < HISTOGRAM_LINEAR) return i;
+	i -= HISTOGRAM_LINEAR;
+	int e = (i >> HISTOGRAM_SUB_BITS) + 5;
+	int sub = i & ((1 << HISTOGRAM_SUB_BITS) - 1);
+	Uint32 low = (1u << e) + ((Uint32)sub << (e - HISTOGRAM_SUB_BITS));
+	return low + (1u << (e - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void histogram_add(Histogram *h, Uint32 us) {
+	atomic_fetch_add_explicit(&h->buckets[bucket_index(us)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+	Uint32 max = atomic_load_explicit(&h->max, memory_order_relaxed);
+	while(us > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, us,
+			memory_order_relaxed, memory_order_relaxed));
+}
+
+Uint32 histogram_percentile(Histogram *h, double p) {
+	Uint32 count = atomic_load_explicit(&h->count, memory_order_relaxed);
+	if(count == 0) return 0;
+	// Rank of the sample wanted, counting from 1
+	Uint64 rank = (Uint64)(p * count + 0.999999);
+	if(rank < 1) rank = 1;
+	Uint64 seen = 0;
+	Uint32 max = atomic_load_explicit(&h->max, memory_order_relaxed);
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+		if(seen >= rank) return bucket_top(i) < max ? bucket_top(i) : max;
+	}
+	return max;
+}
+
+bool profile_dump(const char *filename) {
+	FILE *file = fopen(filename, "w");
+	if(!file) {
+		log_msgf(ERROR, "Profile: Unable to create \"%s\".\n", filename);
+		return false;
+	}
+	fprintf(file, "phase,count,p50_us,p99_us,p999_us,max_us\n");
+	for(int i = 0; i < PHASE_COUNT; i++) {
+		Histogram *h = &PhaseTimes[i];
+		fprintf(file, "%s,%u,%u,%u,%u,%u\n", PhaseNames[i], atomic_load(&h->count),
+			histogram_percentile(h, 0.5), histogram_percentile(h, 0.99),
+			histogram_percentile(h, 0.999), atomic_load(&h->max));
+	}
+	fclose(file);
+	return true;
+}
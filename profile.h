@@ -0,0 +1,45 @@
+#ifndef TETRIS_PROFILE
+#define TETRIS_PROFILE
+
+#include <stdatomic.h>
+
+#include "types.h"
+
+// Durations up to 32us land in their own bucket, longer ones in one of 16
+// buckets per power of two, so every bucket is within 1/16th of its value
+#define HISTOGRAM_LINEAR 32
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + (32 - 5) * (1 << HISTOGRAM_SUB_BITS))
+
+// Parts of a frame that get timed
+enum {
+	PHASE_INPUT,   // input_update
+	PHASE_UPDATE,  // game_step
+	PHASE_DRAW,    // Everything draw() submits
+	PHASE_PRESENT, // graphics_flip
+	PHASE_FRAME,   // Start of one frame to the start of the next
+	PHASE_LATENCY, // Key press to the first frame presented after it
+	PHASE_COUNT
+};
+
+extern const char *PhaseNames[PHASE_COUNT];
+
+// Counts of durations in microseconds. Fixed size and only ever touched
+// with atomics, so any thread can add to it while another reads
+typedef struct {
+	_Atomic Uint32 buckets[HISTOGRAM_BUCKETS];
+	_Atomic Uint32 count, max;
+} Histogram;
+
+extern Histogram PhaseTimes[PHASE_COUNT];
+
+void histogram_add(Histogram *h, Uint32 us);
+
+// Duration that p of the samples are at or under, p from 0 to 1. Rounded
+// up to the top of its bucket
+Uint32 histogram_percentile(Histogram *h, double p);
+
+// Writes count, p50, p99, p99.9 and max of every phase
+bool profile_dump(const char *filename);
+
+#endif
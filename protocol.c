@@ -0,0 +1,130 @@
+#include "protocol.h"
+
+#include <string.h>
+
+static void put_u16(Uint8 *p, Uint32 v) { p[0] = v; p[1] = v >> 8; }
+static void put_u32(Uint8 *p, Uint32 v) { put_u16(p, v); put_u16(p + 2, v >> 16); }
+static Uint32 get_u16(const Uint8 *p) { return p[0] | p[1] << 8; }
+static Uint32 get_u32(const Uint8 *p) { return get_u16(p) | get_u16(p + 2) << 16; }
+
+void view_update(SessionView *v, const GameState *g) {
+	v->piece = g->piece;
+	memcpy(v->rows, g->stage.rows, sizeof(v->rows));
+	for(int y = 0; y < STAGE_H; y++) memcpy(v->color[y], g->stage.color[y], STAGE_W);
+	for(int i = 0; i < 5; i++) v->queue[i] = g->queue[i].type;
+	v->hold = (g->heldSomething ? g->hold.type : 8) | g->holded << 4;
+	v->score = g->score;
+	v->lines = g->totalLines;
+	v->level = g->level;
+	v->nextLevel = g->nextLevel;
+	v->mode = g->mode | g->paused << 4;
+}
+
+int delta_encode(Uint8 *out, const SessionView *old, const SessionView *now,
+		int frames, int consumed) {
+	Uint8 *p = out;
+	*p++ = MSG_FRAME;
+	*p++ = frames;
+	*p++ = consumed;
+	Uint8 *fields = p++;
+	*fields = 0;
+	if(memcmp(&old->piece, &now->piece, sizeof(Piece)) != 0) {
+		*fields |= DELTA_PIECE;
+		*p++ = now->piece.x; *p++ = now->piece.y;
+		*p++ = now->piece.type; *p++ = now->piece.flip;
+	}
+	Uint32 changed = 0;
+	for(int y = 0; y < STAGE_H; y++) {
+		// A line clear can move a row with the same blocks but other colors
+		if(old->rows[y] != now->rows[y] ||
+				memcmp(old->color[y], now->color[y], STAGE_W) != 0) {
+			changed |= 1 << y;
+		}
+	}
+	if(changed) {
+		*fields |= DELTA_ROWS;
+		put_u32(p, changed);
+		p += 4;
+		for(int y = 0; y < STAGE_H; y++) {
+			if(!(changed & 1 << y)) continue;
+			put_u16(p, now->rows[y]);
+			p += 2;
+			for(int x = 0; x < STAGE_W; x += 2) {
+				*p++ = now->color[y][x] | now->color[y][x + 1] << 4;
+			}
+		}
+	}
+	if(memcmp(old->queue, now->queue, 5) != 0 || old->hold != now->hold) {
+		*fields |= DELTA_QUEUE;
+		memcpy(p, now->queue, 5);
+		p[5] = now->hold;
+		p += 6;
+	}
+	if(old->score != now->score || old->lines != now->lines ||
+			old->level != now->level || old->nextLevel != now->nextLevel) {
+		*fields |= DELTA_STATS;
+		put_u32(p, now->score);
+		put_u16(p + 4, now->lines);
+		p[6] = now->level;
+		p[7] = now->nextLevel;
+		p += 8;
+	}
+	if(old->mode != now->mode) {
+		*fields |= DELTA_MODE;
+		*p++ = now->mode;
+	}
+	return p - out;
+}
+
+int delta_decode(SessionView *v, const Uint8 *in, int size, int *frames, int *consumed) {
+	if(size < 4) return 0;
+	if(in[0] != MSG_FRAME || in[3] & ~DELTA_ALL || in[2] > in[1]) return -1;
+	// Work out the length before touching v, so a partial message is left alone
+	int fields = in[3], length = 4;
+	if(fields & DELTA_PIECE) length += 4;
+	if(fields & DELTA_ROWS) {
+		if(size < length + 4) return 0;
+		Uint32 changed = get_u32(in + length);
+		if(changed >> STAGE_H) return -1;
+		length += 4 + __builtin_popcount(changed) * (2 + STAGE_W / 2);
+	}
+	if(fields & DELTA_QUEUE) length += 6;
+	if(fields & DELTA_STATS) length += 8;
+	if(fields & DELTA_MODE) length += 1;
+	if(size < length) return 0;
+	*frames = in[1];
+	*consumed = in[2];
+	const Uint8 *p = in + 4;
+	if(fields & DELTA_PIECE) {
+		v->piece = (Piece){ p[0], p[1], p[2], p[3] };
+		p += 4;
+	}
+	if(fields & DELTA_ROWS) {
+		Uint32 changed = get_u32(p);
+		p += 4;
+		for(int y = 0; y < STAGE_H; y++) {
+			if(!(changed & 1 << y)) continue;
+			v->rows[y] = get_u16(p);
+			p += 2;
+			for(int x = 0; x < STAGE_W; x += 2) {
+				v->color[y][x] = *p & 0xF;
+				v->color[y][x + 1] = *p++ >> 4;
+			}
+		}
+	}
+	if(fields & DELTA_QUEUE) {
+		memcpy(v->queue, p, 5);
+		v->hold = p[5];
+		p += 6;
+	}
+	if(fields & DELTA_STATS) {
+		v->score = get_u32(p);
+		v->lines = get_u16(p + 4);
+		v->level = p[6];
+		v->nextLevel = p[7];
+		p += 8;
+	}
+	if(fields & DELTA_MODE) v->mode = *p++;
+	v->frames += *frames;
+	return length;
+}
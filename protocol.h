@@ -0,0 +1,60 @@
+#ifndef TETRIS_PROTOCOL
+#define TETRIS_PROTOCOL
+
+#include "game.h"
+
+// Messages between tetris-server and its clients over a stream socket. Each
+// starts with its type byte, numbers are little endian
+
+// Client to server
+#define MSG_START 1 // u64 seed, starts the session's game over with it
+#define MSG_INPUT 2 // u8 count then count u16 InputBits, one per frame
+// Server to client, one per tick that stepped the session:
+// u8 frames stepped, u8 of those that used queued input (the rest held the
+// last keys again), u8 DELTA_ fields, then each field that changed
+#define MSG_FRAME 3
+
+// Fields of a MSG_FRAME, in the order they follow it
+#define DELTA_PIECE 1 // x, y, type, flip
+#define DELTA_ROWS 2  // u32 rows that changed, for each one from the top its
+                      // u16 bits then the colors of its 10 cells, 4 bits each
+#define DELTA_QUEUE 4 // 5 piece types then the hold, see SessionView
+#define DELTA_STATS 8 // u32 score, u16 lines, u8 level, u8 lines to next level
+#define DELTA_MODE 16 // Game mode, paused in bit 4
+#define DELTA_ALL 31
+
+// Longest a MSG_FRAME can be, with every row changed
+#define FRAME_MSG_MAX (6 + 4 + 4 + STAGE_H * (2 + STAGE_W / 2) + 6 + 8 + 1)
+
+// The part of a game a client can see, all of it rebuilt from MSG_FRAMEs.
+// Sessions are always played on the standard stage
+typedef struct {
+	Piece piece;
+	Row rows[STAGE_H];
+	Uint8 color[STAGE_H][STAGE_W];
+	Uint8 queue[5];
+	// Held piece type, 8 if nothing has been held yet, bit 4 set when
+	// the current piece came out of the hold
+	Uint8 hold;
+	Uint32 score;
+	Uint16 lines;
+	Uint8 level, nextLevel;
+	Uint8 mode;
+	// Frames stepped since MSG_START
+	Uint32 frames;
+} SessionView;
+
+// Fills v from g as a client would see it
+void view_update(SessionView *v, const GameState *g);
+
+// Writes the MSG_FRAME that takes a client from old to now, returns its
+// length. At most FRAME_MSG_MAX bytes
+int delta_encode(Uint8 *out, const SessionView *old, const SessionView *now,
+	int frames, int consumed);
+
+// Applies a MSG_FRAME from in to v. Returns the bytes it took up, 0 if it
+// isn't all there yet, or -1 if it isn't a valid MSG_FRAME. The frames
+// and consumed counts it carried are put in frames and consumed
+int delta_decode(SessionView *v, const Uint8 *in, int size, int *frames, int *consumed);
+
+#endif
@@ -0,0 +1,79 @@
+#include "random.h"
+
+#include "logsys.h"
+
+#define PCG_MULTIPLIER 6364136223846793005ULL
+#define PCG_INCREMENT 1442695040888963407ULL
+
+void rng_seed(Rng *r, Uint64 seed) {
+	r->state = 0;
+	rng_next(r);
+	r->state += seed;
+	rng_next(r);
+}
+
+Uint32 rng_next(Rng *r) {
+	Uint64 old = r->state;
+	r->state = old * PCG_MULTIPLIER + PCG_INCREMENT;
+	Uint32 xorshifted = ((old >> 18) ^ old) >> 27;
+	Uint32 rot = old >> 59;
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Multiply and keep the high half instead of dividing. The bias is far
+// too small to matter for the tiny ranges the game asks for
+Uint32 rng_below(Rng *r, Uint32 n) {
+	return ((Uint64)rng_next(r) * n) >> 32;
+}
+
+void bag_seed(Bag *b, Uint64 seed) {
+	rng_seed(&b->rng, seed);
+	b->head = 0;
+	b->count = 0;
+}
+
+// Fisher-Yates shuffle straight into the ring buffer
+void fill_random_bag(Bag *b) {
+	Uint8 bag[7] = { 0, 1, 2, 3, 4, 5, 6 };
+	for(int i = 6; i > 0; i--) {
+		int j = rng_below(&b->rng, i + 1);
+		Uint8 t = bag[i]; bag[i] = bag[j]; bag[j] = t;
+	}
+	for(int i = 0; i < 7; i++) {
+		b->pieces[(b->head + b->count + i) % BAG_BUFFER] = bag[i];
+	}
+	b->count += 7;
+	log_msgf(TRACE, "FillBag: %hhu, %hhu, %hhu, %hhu, %hhu, %hhu, %hhu\n",
+		bag[0], bag[1], bag[2], bag[3], bag[4], bag[5], bag[6]);
+}
+
+void bag_fill(Bag *b, int k) {
+	while(b->count < k) fill_random_bag(b);
+}
+
+Uint8 bag_peek(const Bag *b, int i) {
+	return b->pieces[(b->head + i) % BAG_BUFFER];
+}
+
+Uint8 bag_next(Bag *b) {
+	if(b->count == 0) fill_random_bag(b);
+	Uint8 piece = b->pieces[b->head];
+	b->head = (b->head + 1) % BAG_BUFFER;
+	b->count--;
+	return piece;
+}
+
+void bag_generate(Bag *b, Uint8 *out, int n) {
+	int i = 0;
+	// Drain whatever is already buffered, then shuffle bags directly
+	while(i < n && b->count > 0) out[i++] = bag_next(b);
+	while(n - i >= 7) {
+		for(int j = 0; j < 7; j++) out[i + j] = j;
+		for(int j = 6; j > 0; j--) {
+			int k = rng_below(&b->rng, j + 1);
+			Uint8 t = out[i + j]; out[i + j] = out[i + k]; out[i + k] = t;
+		}
+		i += 7;
+	}
+	while(i < n) out[i++] = bag_next(b);
+}
@@ -0,0 +1,48 @@
+#ifndef TETRIS_RANDOM
+#define TETRIS_RANDOM
+
+#include "types.h"
+
+// Upcoming pieces are kept in a ring this big, whole bags at a time
+#define BAG_BUFFER 32
+// How far ahead bag_fill can be asked to look
+#define BAG_LOOKAHEAD (BAG_BUFFER - 6)
+
+// PCG32 generator, 8 bytes of state and no shared globals
+typedef struct {
+	Uint64 state;
+} Rng;
+
+// 7-bag piece generator with a buffer of pieces already decided
+typedef struct {
+	Rng rng;
+	Uint8 pieces[BAG_BUFFER];
+	Uint8 head, count;
+} Bag;
+
+void rng_seed(Rng *r, Uint64 seed);
+
+Uint32 rng_next(Rng *r);
+
+// Random number from 0 to n-1
+Uint32 rng_below(Rng *r, Uint32 n);
+
+// Starts a new piece sequence, the same seed always gives the same pieces
+void bag_seed(Bag *b, Uint64 seed);
+
+// Shuffles one more bag of all 7 pieces onto the end of the buffer
+void fill_random_bag(Bag *b);
+
+// Makes sure at least k pieces are decided, k can be up to BAG_LOOKAHEAD
+void bag_fill(Bag *b, int k);
+
+// The i-th upcoming piece without taking it, call bag_fill(b, i + 1) first
+Uint8 bag_peek(const Bag *b, int i);
+
+// Takes the next piece
+Uint8 bag_next(Bag *b);
+
+// Takes the next n pieces in bulk, the same ones bag_next would give
+void bag_generate(Bag *b, Uint8 *out, int n);
+
+#endif
@@ -0,0 +1,506 @@
+#include "replay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "logsys.h"
+
+// Every record starts with one byte. The low 4 bits say how the keys
+// changed, the high 4 bits are how many frames the new keys were held
+// for. A run of 0 means the length didn't fit and follows as a varint
+#define OP_SET 10      // More than one key changed, the new bits follow as a varint
+#define OP_SAME 11     // Nothing changed, at the start or when a snapshot split a run
+#define OP_SNAPSHOT 12 // No input, the game follows as write_snapshot lays it out
+#define OP_EVENTS 13   // One frame of key events, the high 4 bits are count - 1.
+                       // Each is a byte of bit index | down << 4 and a varint time
+#define OP_END 15      // End of the records, the trailer comes next
+// Ops 0 to 9 toggle that one bit of InputBits, which is how most frames look
+
+static void put_u32(Uint8 *p, Uint32 v) {
+	for(int i = 0; i < 4; i++) p[i] = v >> (i * 8);
+}
+
+static Uint32 get_u32(const Uint8 *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (Uint32)p[3] << 24;
+}
+
+static void put_u16(Uint8 *p, Uint16 v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static Uint16 get_u16(const Uint8 *p) {
+	return p[0] | p[1] << 8;
+}
+
+static void put_u64(Uint8 *p, Uint64 v) {
+	put_u32(p, (Uint32)v);
+	put_u32(p + 4, (Uint32)(v >> 32));
+}
+
+static Uint64 get_u64(const Uint8 *p) {
+	return get_u32(p) | (Uint64)get_u32(p + 4) << 32;
+}
+
+// A snapshot is the stage's colors for the cells in use, two to a byte with
+// the left one in the low bits, then the rest of the GameState field by
+// field. The rows, surface and hash all follow from the colors, and the
+// ghost is worked out again when it's next wanted
+#define SNAPSHOT_FIELDS_SIZE (100 + BAG_BUFFER)
+#define MAX_SNAPSHOT_SIZE (MAX_STAGE_H * (MAX_STAGE_W + 1) / 2 + SNAPSHOT_FIELDS_SIZE)
+
+static int snapshot_size(StageSize size) {
+	return size.height * ((size.width + 1) / 2) + SNAPSHOT_FIELDS_SIZE;
+}
+
+static Uint8 *put_piece(Uint8 *p, Piece piece) {
+	p[0] = piece.x;
+	p[1] = piece.y;
+	p[2] = piece.type;
+	p[3] = piece.flip;
+	return p + 4;
+}
+
+static const Uint8 *get_piece(const Uint8 *p, Piece *piece) {
+	*piece = (Piece){ p[0], p[1], p[2], p[3] };
+	return p + 4;
+}
+
+static void write_snapshot(FILE *f, const GameState *g) {
+	Uint8 buf[MAX_SNAPSHOT_SIZE], *p = buf;
+	const Stage *s = &g->stage;
+	for(int y = 0; y < s->size.height; y++) {
+		for(int x = 0; x < s->size.width; x += 2) {
+			Uint8 right = x + 1 < s->size.width ? s->color[y][x + 1] : 0;
+			*p++ = s->color[y][x] | right << 4;
+		}
+	}
+	*p++ = g->mode;
+	put_u64(p, g->bag.rng.state);
+	p += 8;
+	*p++ = g->bag.head;
+	*p++ = g->bag.count;
+	memcpy(p, g->bag.pieces, BAG_BUFFER);
+	p += BAG_BUFFER;
+	const int ints[] = {
+		g->blockSpeed, g->blockTime, g->score, g->linesCleared, g->totalLines,
+		g->level, g->nextLevel, g->autoShift, g->shiftDirection
+	};
+	for(int i = 0; i < 9; i++, p += 4) put_u32(p, ints[i]);
+	p = put_piece(p, g->piece);
+	p = put_piece(p, g->hold);
+	for(int i = 0; i < 5; i++) p = put_piece(p, g->queue[i]);
+	*p++ = g->holded | g->heldSomething << 1 | g->paused << 2 | g->dropping << 3;
+	put_u16(p, g->keys);
+	put_u16(p + 2, g->oldKeys);
+	put_u32(p + 4, g->frames);
+	put_u32(p + 8, g->pieces);
+	put_u64(p + 12, g->clearedRows);
+	put_u32(p + 20, g->stageChanges);
+	p += 24;
+	fwrite(buf, 1, p - buf, f);
+}
+
+// Reads back a snapshot of a game on a stage of the given size. False if
+// it holds a color no piece has, the rest is up to snapshot_valid
+static bool read_snapshot(const Uint8 *p, StageSize size, GameState *g) {
+	memset(g, 0, sizeof(GameState));
+	Stage *s = &g->stage;
+	s->size = size;
+	s->full = (Row)((1 << size.width) - 1);
+	memset(s->surface, size.height, sizeof(s->surface));
+	for(int y = 0; y < size.height; y++) {
+		for(int x = 0; x < size.width; x++) {
+			Uint8 color = p[x / 2] >> (x % 2 * 4) & 0xF;
+			if(color > 7) return false;
+			s->color[y][x] = color;
+			if(!color) continue;
+			s->rows[y] |= 1 << x;
+			if(y < s->surface[x]) s->surface[x] = y;
+		}
+		s->hash ^= zobrist_row(y, s->rows[y]);
+		p += (size.width + 1) / 2;
+	}
+	g->mode = *p++;
+	g->bag.rng.state = get_u64(p);
+	p += 8;
+	g->bag.head = *p++;
+	g->bag.count = *p++;
+	memcpy(g->bag.pieces, p, BAG_BUFFER);
+	p += BAG_BUFFER;
+	int *ints[] = {
+		&g->blockSpeed, &g->blockTime, &g->score, &g->linesCleared, &g->totalLines,
+		&g->level, &g->nextLevel, &g->autoShift, &g->shiftDirection
+	};
+	for(int i = 0; i < 9; i++, p += 4) *ints[i] = (int)get_u32(p);
+	p = get_piece(p, &g->piece);
+	p = get_piece(p, &g->hold);
+	for(int i = 0; i < 5; i++) p = get_piece(p, &g->queue[i]);
+	Uint8 flags = *p++;
+	g->holded = flags & 1;
+	g->heldSomething = flags >> 1 & 1;
+	g->paused = flags >> 2 & 1;
+	g->dropping = flags >> 3 & 1;
+	g->keys = get_u16(p);
+	g->oldKeys = get_u16(p + 2);
+	g->frames = get_u32(p + 4);
+	g->pieces = get_u32(p + 8);
+	g->clearedRows = get_u64(p + 12);
+	g->stageChanges = get_u32(p + 20);
+	return true;
+}
+
+static void write_varint(FILE *f, Uint32 v) {
+	while(v >= 0x80) {
+		fputc((v & 0x7F) | 0x80, f);
+		v >>= 7;
+	}
+	fputc(v, f);
+}
+
+static Uint32 read_varint(Replay *r) {
+	Uint32 v = 0;
+	for(int shift = 0; r->pos < r->size && shift < 32; shift += 7) {
+		Uint8 b = r->data[r->pos++];
+		v |= (Uint32)(b & 0x7F) << shift;
+		if(!(b & 0x80)) break;
+	}
+	return v;
+}
+
+bool replay_record(ReplayWriter *w, const char *filename, Uint64 seed, StageSize size) {
+	w->file = fopen(filename, "wb");
+	if(!w->file) {
+		log_msgf(ERROR, "Replay: Unable to create \"%s\".\n", filename);
+		return false;
+	}
+	Uint8 header[REPLAY_HEADER_SIZE] = { 'T', 'R', 'P', 'L', REPLAY_VERSION, 0 };
+	put_u16(header + 6, snapshot_size(size));
+	put_u64(header + 8, seed);
+	header[16] = size.width;
+	header[17] = size.height;
+	header[18] = size.hidden;
+	fwrite(header, 1, sizeof(header), w->file);
+	w->bits = w->last = 0;
+	w->run = w->frames = 0;
+	return true;
+}
+
+// Writes out the run that just ended
+static void write_run(ReplayWriter *w) {
+	InputBits changed = w->bits ^ w->last;
+	int op;
+	if(changed == 0) op = OP_SAME;
+	else if((changed & (changed - 1)) == 0) op = __builtin_ctz(changed);
+	else op = OP_SET;
+	int shortRun = w->run < 16 ? w->run : 0;
+	fputc(op | shortRun << 4, w->file);
+	if(op == OP_SET) write_varint(w->file, w->bits);
+	if(!shortRun) write_varint(w->file, w->run);
+	w->last = w->bits;
+}
+
+// Counts another frame, snapshotting the game every so often
+static void begin_frame(ReplayWriter *w, const GameState *g) {
+	if(w->frames > 0 && w->frames % REPLAY_SNAPSHOT_INTERVAL == 0) {
+		if(w->run > 0) write_run(w);
+		w->run = 0;
+		fputc(OP_SNAPSHOT, w->file);
+		write_snapshot(w->file, g);
+	}
+	w->frames++;
+}
+
+void replay_frame(ReplayWriter *w, const GameState *g, InputBits bits) {
+	if(!w->file) return;
+	begin_frame(w, g);
+	if(w->run > 0 && bits != w->bits) {
+		write_run(w);
+		w->run = 0;
+	}
+	w->bits = bits;
+	w->run++;
+}
+
+void replay_events(ReplayWriter *w, const GameState *g, const InputEvent *events, int count) {
+	if(!w->file) return;
+	// Most frames are just keys changing at the start, which game_step
+	// does by itself and runs compress far better
+	InputBits bits = g->keys;
+	for(int i = 0; i < count; i++) {
+		if(events[i].down) bits |= events[i].key;
+		else bits &= ~events[i].key;
+	}
+	InputEvent plain[MAX_FRAME_EVENTS];
+	bool same = game_input_events(g, bits, plain) == count;
+	for(int i = 0; same && i < count; i++) {
+		same = plain[i].key == events[i].key && plain[i].down == events[i].down &&
+			plain[i].time == events[i].time;
+	}
+	if(same) {
+		replay_frame(w, g, bits);
+		return;
+	}
+	begin_frame(w, g);
+	if(w->run > 0) write_run(w);
+	w->run = 0;
+	fputc(OP_EVENTS | (count - 1) << 4, w->file);
+	for(int i = 0; i < count; i++) {
+		fputc(__builtin_ctz(events[i].key) | events[i].down << 4, w->file);
+		write_varint(w->file, events[i].time);
+		// The keys runs after this one are compared against
+		if(events[i].down) w->bits |= events[i].key;
+		else w->bits &= ~events[i].key;
+	}
+	w->last = w->bits;
+}
+
+void replay_finish(ReplayWriter *w, const GameState *g) {
+	if(!w->file) return;
+	if(w->run > 0) write_run(w);
+	fputc(OP_END, w->file);
+	Uint8 trailer[REPLAY_TRAILER_SIZE];
+	put_u32(trailer, w->frames);
+	put_u32(trailer + 4, g->pieces);
+	put_u32(trailer + 8, g->totalLines);
+	put_u32(trailer + 12, g->score);
+	fwrite(trailer, 1, sizeof(trailer), w->file);
+	fclose(w->file);
+	w->file = NULL;
+}
+
+static void replay_rewind(Replay *r) {
+	r->pos = r->start;
+	r->bits = 0;
+	r->run = r->frame = 0;
+	r->eventCount = 0;
+}
+
+// Reads one record, returns the op
+static int read_record(Replay *r) {
+	Uint8 b = r->data[r->pos++];
+	int op = b & 0xF;
+	r->eventCount = 0;
+	if(op == OP_END) {
+		r->pos = r->size;
+		return op;
+	}
+	if(op == OP_SNAPSHOT) {
+		r->pos += r->snapshotSize;
+		return op;
+	}
+	if(op == OP_EVENTS) {
+		r->eventCount = (b >> 4) + 1;
+		for(int i = 0; i < r->eventCount && r->pos < r->size; i++) {
+			Uint8 e = r->data[r->pos++];
+			InputEvent *event = &r->events[i];
+			event->key = 1 << (e & 0xF);
+			event->down = e >> 4;
+			event->time = read_varint(r);
+			if(event->down) r->bits |= event->key;
+			else r->bits &= ~event->key;
+		}
+		r->run = 1;
+		return op;
+	}
+	if(op < OP_SET) r->bits ^= 1 << op;
+	else if(op == OP_SET) r->bits = read_varint(r);
+	r->run = b >> 4;
+	if(r->run == 0) r->run = read_varint(r);
+	return op;
+}
+
+// Walks every record once to find the snapshots
+static bool build_index(Replay *r) {
+	int capacity = r->summary.frames / REPLAY_SNAPSHOT_INTERVAL + 1;
+	r->snapshots = malloc(capacity * sizeof(ReplaySnapshot));
+	if(!r->snapshots) return false;
+	Uint32 frame = 0;
+	replay_rewind(r);
+	while(r->pos < r->size) {
+		if(read_record(r) == OP_SNAPSHOT) {
+			if(r->pos > r->size || r->snapshotCount == capacity) return false;
+			r->snapshots[r->snapshotCount++] = (ReplaySnapshot){
+				frame, r->bits, r->pos - r->snapshotSize
+			};
+		}
+		frame += r->run;
+		r->run = 0;
+	}
+	replay_rewind(r);
+	return frame == r->summary.frames;
+}
+
+bool replay_load(Replay *r, const char *filename) {
+	memset(r, 0, sizeof(Replay));
+	FILE *file = fopen(filename, "rb");
+	if(!file) {
+		log_msgf(ERROR, "Replay: Unable to open \"%s\".\n", filename);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if(size < REPLAY_HEADER_SIZE_V3 + REPLAY_TRAILER_SIZE) {
+		log_msgf(ERROR, "Replay: \"%s\" is too short.\n", filename);
+		fclose(file);
+		return false;
+	}
+	r->data = malloc(size);
+	r->size = size;
+	if(!r->data || fread(r->data, 1, size, file) != (size_t)size) {
+		log_msgf(ERROR, "Replay: Unable to read \"%s\".\n", filename);
+		fclose(file);
+		replay_free(r);
+		return false;
+	}
+	fclose(file);
+	// Older versions are the same without snapshots or key events
+	if(memcmp(r->data, "TRPL", 4) != 0 || r->data[4] < 1 || r->data[4] > REPLAY_VERSION) {
+		log_msgf(ERROR, "Replay: \"%s\" is not a version %d replay.\n",
+			filename, REPLAY_VERSION);
+		replay_free(r);
+		return false;
+	}
+	r->snapshotSize = get_u16(r->data + 6);
+	r->seed = get_u64(r->data + 8);
+	r->start = REPLAY_HEADER_SIZE_V3;
+	r->stage = StandardStage;
+	if(r->data[4] >= 4) {
+		r->start = REPLAY_HEADER_SIZE;
+		r->stage = (StageSize){ r->data[16], r->data[17], r->data[18] };
+		if(r->size < r->start + REPLAY_TRAILER_SIZE || !stage_size_valid(r->stage)) {
+			log_msgf(ERROR, "Replay: \"%s\" is damaged.\n", filename);
+			replay_free(r);
+			return false;
+		}
+	}
+	const Uint8 *trailer = r->data + r->size - REPLAY_TRAILER_SIZE;
+	r->summary.frames = get_u32(trailer);
+	r->summary.pieces = get_u32(trailer + 4);
+	r->summary.lines = get_u32(trailer + 8);
+	r->summary.score = get_u32(trailer + 12);
+	// Stop reading records where the trailer starts
+	r->size -= REPLAY_TRAILER_SIZE;
+	if(!build_index(r)) {
+		log_msgf(ERROR, "Replay: \"%s\" is damaged.\n", filename);
+		replay_free(r);
+		return false;
+	}
+	// Before version 5 snapshots were the GameState as it was in memory,
+	// which has changed layout since without always changing size
+	if(r->data[4] < 5 || r->snapshotSize != snapshot_size(r->stage)) {
+		// Still playable from the start, the snapshots just get skipped
+		if(r->snapshotCount > 0) {
+			log_msgf(WARNING, "Replay: \"%s\" snapshots are from an older version.\n",
+				filename);
+		}
+		r->snapshotCount = 0;
+	}
+	return true;
+}
+
+void replay_free(Replay *r) {
+	free(r->data);
+	free(r->snapshots);
+	r->data = NULL;
+	r->snapshots = NULL;
+	r->size = 0;
+	r->snapshotCount = 0;
+}
+
+bool replay_next(Replay *r, InputBits *bits) {
+	while(r->run == 0) {
+		if(r->pos >= r->size) return false;
+		read_record(r);
+	}
+	r->run--;
+	r->frame++;
+	*bits = r->bits;
+	return true;
+}
+
+static bool piece_valid(Piece p) {
+	return p.type < 7 && p.flip < 4;
+}
+
+// Also inside the walls and above the floor, as the current and held
+// pieces always are. Rows above the stage are fine, blocks there are lost
+static bool piece_on_stage(Piece p, StageSize size) {
+	if(!piece_valid(p)) return false;
+	const PieceShape *s = &PieceShapes[p.type][p.flip];
+	return p.x + s->minX >= 0 && p.x + s->maxX < size.width && p.y + s->maxY < size.height;
+}
+
+// Whether a snapshot is safe for game_step to carry on from. Anything could
+// be in the file, and an index out of range here is a read or write past
+// the end of the stage or the shape tables later. The stage itself is
+// rebuilt from its colors so it always holds together
+static bool snapshot_valid(const GameState *g) {
+	if(g->mode < MODE_TITLE || g->mode > MODE_GAMEOVER) return false;
+	if(g->clearedRows >> g->stage.size.height) return false;
+	if(!piece_on_stage(g->piece, g->stage.size) || !piece_on_stage(g->hold, g->stage.size)) {
+		return false;
+	}
+	for(int i = 0; i < 5; i++) {
+		if(!piece_valid(g->queue[i])) return false;
+	}
+	// A game that's still going always has its piece somewhere it fits
+	if(g->mode == MODE_STAGE && !validate_piece(g, g->piece)) return false;
+	if(g->bag.head >= BAG_BUFFER || g->bag.count > BAG_BUFFER) return false;
+	for(int i = 0; i < g->bag.count; i++) {
+		if(g->bag.pieces[(g->bag.head + i) % BAG_BUFFER] >= 7) return false;
+	}
+	return true;
+}
+
+bool replay_seek(Replay *r, GameState *g, Uint32 frame) {
+	if(frame > r->summary.frames) return false;
+	// Last snapshot at or before the frame
+	int lo = 0, hi = r->snapshotCount;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(r->snapshots[mid].frame <= frame) lo = mid + 1;
+		else hi = mid;
+	}
+	// Damaged ones are passed over for the one before
+	while(lo > 0) {
+		if(read_snapshot(r->data + r->snapshots[lo - 1].pos, r->stage, g) &&
+				snapshot_valid(g)) {
+			break;
+		}
+		log_msgf(WARNING, "Replay: Snapshot at frame %u is damaged.\n",
+			r->snapshots[lo - 1].frame);
+		lo--;
+	}
+	if(lo > 0) {
+		const ReplaySnapshot *s = &r->snapshots[lo - 1];
+		r->pos = s->pos + r->snapshotSize;
+		r->bits = s->bits;
+		r->run = 0;
+		r->frame = s->frame;
+	} else {
+		replay_rewind(r);
+		game_setup(g, r->seed, r->stage);
+	}
+	while(r->frame < frame && replay_step(r, g));
+	return r->frame == frame;
+}
+
+bool replay_step(Replay *r, GameState *g) {
+	InputBits bits;
+	if(!replay_next(r, &bits)) return false;
+	// Before version 3 game_step read the keys once a frame
+	if(r->data[4] < 3) game_step_frames(g, bits);
+	else if(r->eventCount > 0) game_step_events(g, r->events, r->eventCount);
+	else game_step(g, bits);
+	return true;
+}
+
+bool replay_verify(Replay *r, GameState *g) {
+	replay_rewind(r);
+	game_setup(g, r->seed, r->stage);
+	while(replay_step(r, g));
+	return r->frame == r->summary.frames && g->pieces == r->summary.pieces &&
+		(Uint32)g->totalLines == r->summary.lines && g->score == r->summary.score;
+}
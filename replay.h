@@ -0,0 +1,104 @@
+#ifndef TETRIS_REPLAY
+#define TETRIS_REPLAY
+
+#include <stdio.h>
+
+#include "game.h"
+
+// File layout, all numbers little endian:
+//   header   "TRPL", version byte, zero byte, 2 byte snapshot size, 8 byte seed,
+//            then the stage width, height and hidden rows and a zero byte
+//   records  one per change of input, and a snapshot every so often, see replay.c
+//   trailer  frames, pieces, lines and score of the final state, 4 bytes each
+#define REPLAY_VERSION 5
+#define REPLAY_HEADER_SIZE 20
+// Versions before 4 end the header at the seed and are all standard stages
+#define REPLAY_HEADER_SIZE_V3 16
+#define REPLAY_TRAILER_SIZE 16
+// Frames between snapshots of the whole game. Seeking never has to
+// simulate more than this many frames
+#define REPLAY_SNAPSHOT_INTERVAL 600
+
+// What the game looked like when recording stopped, used to verify playback
+typedef struct {
+	Uint32 frames, pieces, lines;
+	int score;
+} ReplaySummary;
+
+// Streams a replay to disk one frame at a time
+typedef struct {
+	FILE *file;
+	// Keys held in the run being counted, and how many frames it has been
+	InputBits bits;
+	Uint32 run, frames;
+	// Keys of the last run written, records only store what changed
+	InputBits last;
+} ReplayWriter;
+
+// Where a snapshot is and what the reader looked like right after it
+typedef struct {
+	Uint32 frame;
+	InputBits bits;
+	// Offset of the snapshot, the next record follows it
+	size_t pos;
+} ReplaySnapshot;
+
+// A whole replay loaded into memory, and a read position in it
+typedef struct {
+	Uint8 *data;
+	size_t size, pos;
+	// Where the records start, after the header
+	size_t start;
+	Uint64 seed;
+	StageSize stage;
+	ReplaySummary summary;
+	InputBits bits;
+	Uint32 run, frame;
+	// Key events of the frame replay_next just returned, when it had any
+	// that game_step wouldn't have made by itself
+	InputEvent events[MAX_FRAME_EVENTS];
+	int eventCount;
+	// Size of the snapshots in the file, they're only read when they are
+	// laid out the way this version writes them and skipped over otherwise
+	Uint16 snapshotSize;
+	// Every snapshot in frame order
+	ReplaySnapshot *snapshots;
+	int snapshotCount;
+} Replay;
+
+// Starts recording, games must be started with game_setup(g, seed, size)
+bool replay_record(ReplayWriter *w, const char *filename, Uint64 seed, StageSize size);
+
+// Adds one frame of input, call it right before game_step(g, bits)
+void replay_frame(ReplayWriter *w, const GameState *g, InputBits bits);
+
+// Adds one frame of key events, call it right before
+// game_step_events(g, events, count)
+void replay_events(ReplayWriter *w, const GameState *g, const InputEvent *events, int count);
+
+// Writes out the last run and the final state, then closes the file
+void replay_finish(ReplayWriter *w, const GameState *g);
+
+bool replay_load(Replay *r, const char *filename);
+
+void replay_free(Replay *r);
+
+// Next frame of input, false once the replay has run out. Keys held at the
+// end of the frame, the events themselves are in r->events
+bool replay_next(Replay *r, InputBits *bits);
+
+// Steps g by the next frame the same way it was recorded, false once the
+// replay has run out
+bool replay_step(Replay *r, GameState *g);
+
+// Puts g in the state it was in after the given number of frames, and the
+// replay at the input for the frame after. Starts from the last snapshot
+// at or before the frame, or from the beginning if there isn't one.
+// Returns false if the replay is shorter than that
+bool replay_seek(Replay *r, GameState *g, Uint32 frame);
+
+// Plays the whole replay from the start with no rendering. Leaves the final
+// state in g and returns true if it matches what was recorded
+bool replay_verify(Replay *r, GameState *g);
+
+#endif
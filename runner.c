@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "runner.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "logsys.h"
+
+// One thread's share of the games. The range [lo, hi) is packed into a
+// single word so the owner taking from the bottom and thieves taking from
+// the top both claim games with one compare and swap
+typedef struct {
+	_Alignas(64) _Atomic Uint64 range;
+	int played, steals;
+} Worker;
+
+typedef struct {
+	Worker workers[MAX_THREADS];
+	int threads;
+	// Games nobody has claimed yet, workers quit once this reaches zero
+	atomic_int unclaimed;
+	PlayFunc play;
+	void *ctx;
+	GameResult *results;
+} Runner;
+
+typedef struct {
+	Runner *runner;
+	int id;
+} WorkerArgs;
+
+static Uint64 pack_range(Uint32 lo, Uint32 hi) { return (Uint64)hi << 32 | lo; }
+
+// Claims the lowest game left in the worker's own range
+static bool take_own(Worker *w, int *game) {
+	Uint64 r = atomic_load(&w->range);
+	for(;;) {
+		Uint32 lo = (Uint32)r, hi = r >> 32;
+		if(lo >= hi) return false;
+		if(atomic_compare_exchange_weak(&w->range, &r, pack_range(lo + 1, hi))) {
+			*game = lo;
+			return true;
+		}
+	}
+}
+
+// Takes the top half of a victim's range, returns the first game of it and
+// moves the rest into the thief's own range
+static bool steal(Worker *thief, Worker *victim, int *game) {
+	Uint64 r = atomic_load(&victim->range);
+	for(;;) {
+		Uint32 lo = (Uint32)r, hi = r >> 32;
+		if(lo >= hi) return false;
+		Uint32 mid = lo + (hi - lo) / 2;
+		if(atomic_compare_exchange_weak(&victim->range, &r, pack_range(lo, mid))) {
+			*game = mid;
+			atomic_store(&thief->range, pack_range(mid + 1, hi));
+			thief->steals++;
+			return true;
+		}
+	}
+}
+
+static void *worker_main(void *arg) {
+	WorkerArgs *args = arg;
+	Runner *runner = args->runner;
+	Worker *self = &runner->workers[args->id];
+	int game;
+	while(atomic_load(&runner->unclaimed) > 0) {
+		bool found = take_own(self, &game);
+		// Look for work starting with the next thread along so thieves
+		// don't all pile onto the same victim
+		for(int i = 1; !found && i < runner->threads; i++) {
+			Worker *victim = &runner->workers[(args->id + i) % runner->threads];
+			found = steal(self, victim, &game);
+		}
+		if(!found) {
+			// Games are still moving between threads, try again shortly
+			sched_yield();
+			continue;
+		}
+		atomic_fetch_sub(&runner->unclaimed, 1);
+		runner->play(game, &runner->results[game], runner->ctx);
+		self->played++;
+	}
+	return NULL;
+}
+
+void runner_run(int games, int threads, PlayFunc play, void *ctx,
+		GameResult *results, RunnerReport *report) {
+	static Runner runner;
+	pthread_t handles[MAX_THREADS];
+	bool started[MAX_THREADS];
+	WorkerArgs args[MAX_THREADS];
+	if(threads < 1) threads = 1;
+	if(threads > MAX_THREADS) threads = MAX_THREADS;
+	runner.threads = threads;
+	runner.play = play;
+	runner.ctx = ctx;
+	runner.results = results;
+	atomic_store(&runner.unclaimed, games);
+	// Equal contiguous shares to start with
+	for(int i = 0; i < threads; i++) {
+		Uint32 lo = (Uint64)games * i / threads, hi = (Uint64)games * (i + 1) / threads;
+		atomic_store(&runner.workers[i].range, pack_range(lo, hi));
+		runner.workers[i].played = 0;
+		runner.workers[i].steals = 0;
+	}
+	Uint64 start = now_ns();
+	// The calling thread works too, as worker 0
+	for(int i = 1; i < threads; i++) {
+		args[i] = (WorkerArgs){ &runner, i };
+		// Any games left behind by a thread that didn't start get stolen
+		started[i] = pthread_create(&handles[i], NULL, worker_main, &args[i]) == 0;
+		if(!started[i]) log_msgf(ERROR, "Runner: Unable to start thread %d.\n", i);
+	}
+	args[0] = (WorkerArgs){ &runner, 0 };
+	worker_main(&args[0]);
+	for(int i = 1; i < threads; i++) {
+		if(started[i]) pthread_join(handles[i], NULL);
+	}
+	report->seconds = (now_ns() - start) / 1e9;
+	report->threads = threads;
+	for(int i = 0; i < threads; i++) {
+		report->played[i] = runner.workers[i].played;
+		report->steals[i] = runner.workers[i].steals;
+	}
+}
+
+int runner_cpu_count() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : (int)n;
+}
+
+static void summary_add(StatSummary *s, int value, bool first) {
+	if(first || value < s->min) s->min = value;
+	if(first || value > s->max) s->max = value;
+	s->total += value;
+}
+
+void runner_stats(const GameResult *results, int games, RunStats *stats) {
+	*stats = (RunStats){ 0 };
+	for(int i = 0; i < games; i++) {
+		const GameResult *r = &results[i];
+		if(r->failed) continue;
+		bool first = stats->games++ == 0;
+		summary_add(&stats->score, r->score, first);
+		summary_add(&stats->lines, r->lines, first);
+		summary_add(&stats->pieces, r->pieces, first);
+		stats->frames += r->frames;
+		stats->searches += r->searches;
+		stats->placements += r->placements;
+	}
+	if(stats->games > 0) {
+		stats->score.mean = (double)stats->score.total / stats->games;
+		stats->lines.mean = (double)stats->lines.total / stats->games;
+		stats->pieces.mean = (double)stats->pieces.total / stats->games;
+	}
+}
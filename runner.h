@@ -0,0 +1,57 @@
+#ifndef TETRIS_RUNNER
+#define TETRIS_RUNNER
+
+#include "game.h"
+
+// Most worker threads a run will start
+#define MAX_THREADS 256
+
+// What a finished game reports back
+typedef struct {
+	int score, lines, pieces;
+	Uint32 frames;
+	// Searches the bot ran and the placements they enumerated
+	Uint64 searches, placements;
+	// The game couldn't be played, none of the above count towards the stats
+	bool failed;
+} GameResult;
+
+// Aggregate of a stat over every game
+typedef struct {
+	double mean;
+	int min, max;
+	Uint64 total;
+} StatSummary;
+
+typedef struct {
+	// Games that didn't fail, the rest are left out
+	int games;
+	StatSummary score, lines, pieces;
+	Uint64 frames, searches, placements;
+} RunStats;
+
+// How the run went, for checking that the work was spread evenly
+typedef struct {
+	int threads;
+	// Wall clock time from starting the first game to finishing the last
+	double seconds;
+	// Games each thread played, and how many times it stole from another
+	int played[MAX_THREADS], steals[MAX_THREADS];
+} RunnerReport;
+
+// Plays game number index and fills in its result. Called from the worker
+// threads, so it may only touch state that belongs to that game
+typedef void (*PlayFunc)(int index, GameResult *result, void *ctx);
+
+// Plays games 0 to games-1 spread over the given number of threads.
+// Each thread starts with an equal share and steals half of another
+// thread's remaining games whenever it runs out
+void runner_run(int games, int threads, PlayFunc play, void *ctx,
+	GameResult *results, RunnerReport *report);
+
+// Number of cores available, at least 1
+int runner_cpu_count();
+
+void runner_stats(const GameResult *results, int games, RunStats *stats);
+
+#endif
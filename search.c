@@ -0,0 +1,532 @@
+#include "search.h"
+#include "collide.h"
+
+#include <limits.h>
+#include <string.h>
+
+// Score given to placements that leave blocks above the top of the stage
+#define SCORE_TOP_OUT (INT_MIN / 2)
+
+// Every position a piece can be in during a search. Pieces can hang up to
+// 3 columns off the left of the stage and a few rows above it. Room for
+// the biggest stage, smaller ones only use the start
+#define SEARCH_LEFT 3
+#define SEARCH_TOP 4
+#define SEARCH_STATES (4 * (MAX_STAGE_W + SEARCH_LEFT) * (MAX_STAGE_H + SEARCH_TOP))
+// Size of the table used to throw away placements that fill the same cells
+#define SEARCH_SEEN 1024
+// The per placement work is written once with the stage size as arguments,
+// and called with constants for the standard size so that copy gets fixed
+// length loops. Any other size runs the same code with the size it has
+#define SPECIALIZED __attribute__((always_inline)) static inline
+#define IS_STANDARD(s) ((s).width == STAGE_W && (s).height == STAGE_H)
+
+// Moves tried from every position, in the order paths prefer them
+const Uint8 SearchMoves[] = {
+	MOVE_SOFT_DROP, MOVE_LEFT, MOVE_RIGHT, MOVE_ROTATE_RIGHT, MOVE_ROTATE_LEFT, MOVE_DOWN
+};
+#define SEARCH_MOVE_COUNT (int)(sizeof(SearchMoves) / sizeof(SearchMoves[0]))
+
+// Weights from Yiyuan Lee's genetic tuning, scaled up to integers
+const HeuristicWeights DefaultWeights = {
+	.height = -51, .holes = -36, .bumpiness = -18, .lines = 76
+};
+
+// One position reached by the search and how it got there
+typedef struct {
+	Piece piece;
+	short parent;
+	Uint8 move, depth;
+} SearchNode;
+
+// Every position of one piece type on the stage, tested all at once by the
+// batch kernels before the search starts. Indexed by state_index
+typedef struct {
+	// Stage size, positions across one row of the map and down one flip,
+	// and positions in all 4 flips
+	int width, height, columns, rows, states;
+	// Set where the piece doesn't fit
+	Uint8 blocked[SEARCH_STATES];
+	// Rows the piece can fall from each position that fits
+	Uint8 drop[SEARCH_STATES];
+} SearchMap;
+
+SPECIALIZED void features(const Row *rows, int width, int height, BoardFeatures *f) {
+	int heights[MAX_STAGE_W] = { 0 };
+	Row seen = 0;
+	f->holes = 0;
+	for(int y = 0; y < height; y++) {
+		// Empty cells in a column that already had a block above them
+		f->holes += __builtin_popcount(seen & ~rows[y]);
+		Row found = rows[y] & ~seen;
+		seen |= found;
+		for(int x = 0; found; x++, found >>= 1) {
+			if(found & 1) heights[x] = height - y;
+		}
+	}
+	f->height = f->maxHeight = f->bumpiness = 0;
+	for(int x = 0; x < width; x++) {
+		f->height += heights[x];
+		if(heights[x] > f->maxHeight) f->maxHeight = heights[x];
+		if(x > 0) {
+			int d = heights[x] - heights[x-1];
+			f->bumpiness += d < 0 ? -d : d;
+		}
+	}
+}
+
+void board_features(const Row *rows, StageSize size, BoardFeatures *f) {
+	if(IS_STANDARD(size)) features(rows, STAGE_W, STAGE_H, f);
+	else features(rows, size.width, size.height, f);
+}
+
+int heuristic_weighted(const Row *rows, StageSize size, int linesCleared, const void *params) {
+	const HeuristicWeights *w = params;
+	BoardFeatures f;
+	board_features(rows, size, &f);
+	return w->height * f.height + w->holes * f.holes +
+		w->bumpiness * f.bumpiness + w->lines * linesCleared;
+}
+
+static int state_index(const SearchMap *m, Piece p) {
+	return (p.flip * m->rows + p.y + SEARCH_TOP) * m->columns + p.x + SEARCH_LEFT;
+}
+
+static void build_map(const GameState *g, int type, SearchMap *m) {
+	CollideBoard b;
+	collide_board(&b, &g->stage);
+	m->width = g->stage.size.width;
+	m->height = g->stage.size.height;
+	m->columns = m->width + SEARCH_LEFT;
+	m->rows = m->height + SEARCH_TOP;
+	m->states = 4 * m->columns * m->rows;
+	Piece batch[COLLIDE_BATCH];
+	int count = 0, i = 0;
+	// The same order state_index counts in
+	for(int flip = 0; flip < 4; flip++) {
+		for(int y = -SEARCH_TOP; y < m->height; y++) {
+			for(int x = -SEARCH_LEFT; x < m->width; x++, i++) {
+				batch[count++] = (Piece){ x, y, type, flip };
+				if(count < COLLIDE_BATCH && i < m->states - 1) continue;
+				Uint64 hits = collide_batch(&b, batch, count);
+				for(int k = 0; k < count; k++) m->blocked[i + 1 - count + k] = hits >> k & 1;
+				count = 0;
+			}
+		}
+	}
+	// From the bottom up, a position falls one row further than the one
+	// under it. Nothing fits under the bottom row of each flip
+	for(int flip = 0; flip < 4; flip++) {
+		int top = flip * m->rows * m->columns, bottom = top + (m->rows - 1) * m->columns;
+		memset(m->drop + bottom, 0, m->columns);
+		for(i = bottom - 1; i >= top; i--) {
+			m->drop[i] = m->blocked[i + m->columns] ? 0 : m->drop[i + m->columns] + 1;
+		}
+	}
+}
+
+// Positions outside the map only ever get thrown away, so they may as
+// well not fit
+static bool map_fits(const SearchMap *m, Piece p) {
+	if(p.x < -SEARCH_LEFT || p.x >= m->width || p.y < -SEARCH_TOP || p.y >= m->height) {
+		return false;
+	}
+	return !m->blocked[state_index(m, p)];
+}
+
+static bool map_locks(const SearchMap *m, Piece p) {
+	p.y++;
+	return !map_fits(m, p);
+}
+
+// Tries the same kicks in the same order as wall_kick
+static bool map_kick(const SearchMap *m, Piece *p) {
+	Piece left = { p->x - 1, p->y, p->type, p->flip };
+	Piece right = { p->x + 1, p->y, p->type, p->flip };
+	Piece up = { p->x, p->y - 1, p->type, p->flip };
+	if(map_fits(m, left)) *p = left;
+	else if(map_fits(m, right)) *p = right;
+	else if(map_fits(m, up)) *p = up;
+	else return false;
+	return true;
+}
+
+// Applies a move the same way the game's actions would, false if the
+// piece can't make it
+static bool try_move(const GameState *g, Piece *p, int move) {
+	Piece n = *p;
+	switch(move) {
+		case MOVE_LEFT:
+		n.x--;
+		if(!validate_piece(g, n)) return false;
+		break;
+		case MOVE_RIGHT:
+		n.x++;
+		if(!validate_piece(g, n)) return false;
+		break;
+		case MOVE_ROTATE_LEFT:
+		n.flip = (n.flip + 3) & 3;
+		if(!validate_piece(g, n) && !wall_kick(g, &n)) return false;
+		break;
+		case MOVE_ROTATE_RIGHT:
+		n.flip = (n.flip + 1) & 3;
+		if(!validate_piece(g, n) && !wall_kick(g, &n)) return false;
+		break;
+		case MOVE_DOWN:
+		if(check_lock(g, n)) return false;
+		n.y++;
+		break;
+		case MOVE_SOFT_DROP: {
+			int distance = drop_distance(g, n);
+			if(distance == 0) return false;
+			n.y += distance;
+		} break;
+	}
+	*p = n;
+	return true;
+}
+
+// try_move looked up in the map
+static bool map_move(const SearchMap *m, Piece *p, int move) {
+	Piece n = *p;
+	switch(move) {
+		case MOVE_LEFT:
+		n.x--;
+		if(!map_fits(m, n)) return false;
+		break;
+		case MOVE_RIGHT:
+		n.x++;
+		if(!map_fits(m, n)) return false;
+		break;
+		case MOVE_ROTATE_LEFT:
+		n.flip = (n.flip + 3) & 3;
+		if(!map_fits(m, n) && !map_kick(m, &n)) return false;
+		break;
+		case MOVE_ROTATE_RIGHT:
+		n.flip = (n.flip + 1) & 3;
+		if(!map_fits(m, n) && !map_kick(m, &n)) return false;
+		break;
+		case MOVE_DOWN:
+		if(map_locks(m, n)) return false;
+		n.y++;
+		break;
+		case MOVE_SOFT_DROP: {
+			int distance = m->drop[state_index(m, n)];
+			if(distance == 0) return false;
+			n.y += distance;
+		} break;
+	}
+	*p = n;
+	return true;
+}
+
+// Identifies the cells a resting piece fills, so different flips or
+// offsets that cover the same cells only count once
+static Uint32 placement_key(Piece p) {
+	const PieceShape *s = &PieceShapes[p.type][p.flip];
+	Uint32 shape = 0;
+	for(int j = s->minY; j <= s->maxY; j++) {
+		shape |= (Uint32)(s->rows[j] >> s->minX) << ((j - s->minY) * 4);
+	}
+	return (Uint32)(Uint8)(p.y + s->minY + SEARCH_TOP) << 24 |
+		(Uint32)(Uint8)(p.x + s->minX + SEARCH_LEFT) << 16 | shape;
+}
+
+// Returns false if the key was already in the table
+static bool mark_seen(Uint32 seen[SEARCH_SEEN], Uint32 key) {
+	Uint32 stored = key + 1; // 0 marks an empty slot
+	for(Uint32 i = (key * 2654435761u) >> 22;; i = (i + 1) & (SEARCH_SEEN - 1)) {
+		if(seen[i] == stored) return false;
+		if(seen[i] == 0) {
+			seen[i] = stored;
+			return true;
+		}
+	}
+}
+
+// Copies the stage rows with p locked into them and its lines cleared.
+// Returns the lines cleared, -1 if p sticks out of the top
+SPECIALIZED int lock_rows(const Stage *st, Piece p, int width, int height, Row *rows) {
+	const PieceShape *s = &PieceShapes[p.type][p.flip];
+	Row full = (Row)((1 << width) - 1);
+	memcpy(rows, st->rows, height * sizeof(Row));
+	for(int i = 0; i < 4; i++) {
+		int y = p.y + s->cells[i].y;
+		if(y < 0) return -1;
+		rows[y] |= 1 << (p.x + s->cells[i].x);
+	}
+	int dst = height - 1;
+	for(int y = height - 1; y >= 0; y--) {
+		if(rows[y] == full) continue;
+		rows[dst--] = rows[y];
+	}
+	int lines = dst + 1;
+	while(dst >= 0) rows[dst--] = 0;
+	return lines;
+}
+
+// Scores the stage as it would be after locking p, counting the lines
+// earlier placements of a lookahead cleared along with its own
+static int evaluate(const GameState *g, Piece p, Heuristic h, const void *params,
+		int linesBefore, int *linesCleared) {
+	const Stage *st = &g->stage;
+	Row rows[MAX_STAGE_H];
+	int lines = IS_STANDARD(st->size) ? lock_rows(st, p, STAGE_W, STAGE_H, rows) :
+		lock_rows(st, p, st->size.width, st->size.height, rows);
+	*linesCleared = 0;
+	if(lines < 0) return SCORE_TOP_OUT;
+	*linesCleared = lines;
+	return h(rows, st->size, linesBefore + lines, params);
+}
+
+// Breadth first search over every position start can reach, appending the
+// resting ones to out. Breadth first means each path is as short as it gets
+static int search_piece(const GameState *g, Piece start, bool held, Heuristic h,
+		const void *params, int linesBefore, Placement *out, int count, int max) {
+	SearchNode nodes[SEARCH_STATES];
+	Uint8 visited[SEARCH_STATES];
+	Uint32 seen[SEARCH_SEEN];
+	SearchMap map;
+	if(!validate_piece(g, start)) return count;
+	// Every placement found takes a slot in seen, and mark_seen only stops
+	// probing at an empty one
+	if(max - count > SEARCH_SEEN - 2) max = count + SEARCH_SEEN - 2;
+	build_map(g, start.type, &map);
+	memset(visited, 0, map.states);
+	memset(seen, 0, sizeof(seen));
+	// Room for the hold and hard drop at either end of the path
+	int maxDepth = MAX_PATH - 1 - held;
+	int head = 0, tail = 0;
+	nodes[tail++] = (SearchNode){ start, -1, 0, 0 };
+	visited[state_index(&map, start)] = true;
+	while(head < tail) {
+		SearchNode node = nodes[head];
+		if(map_locks(&map, node.piece) && mark_seen(seen, placement_key(node.piece))) {
+			if(count == max) return count;
+			Placement *pl = &out[count++];
+			pl->piece = node.piece;
+			int lines;
+			pl->score = evaluate(g, node.piece, h, params, linesBefore, &lines);
+			pl->linesCleared = lines;
+			pl->pathLength = node.depth + held + 1;
+			if(held) pl->path[0] = MOVE_HOLD;
+			pl->path[pl->pathLength - 1] = MOVE_HARD_DROP;
+			for(int i = head, d = node.depth; d > 0; i = nodes[i].parent, d--) {
+				pl->path[held + d - 1] = nodes[i].move;
+			}
+		}
+		if(node.depth < maxDepth) {
+			for(int m = 0; m < SEARCH_MOVE_COUNT; m++) {
+				Piece p = node.piece;
+				if(!map_move(&map, &p, SearchMoves[m])) continue;
+				int index = state_index(&map, p);
+				if(visited[index]) continue;
+				visited[index] = true;
+				nodes[tail++] = (SearchNode){ p, head, SearchMoves[m], node.depth + 1 };
+			}
+		}
+		head++;
+	}
+	return count;
+}
+
+static int search_all(const GameState *g, Heuristic h, const void *params,
+		int linesBefore, Placement *out, int max) {
+	int count = search_piece(g, g->piece, false, h, params, linesBefore, out, 0, max);
+	if(!g->holded) {
+		// Let the game work out what holding gives us and where it spawns
+		GameState held = *g;
+		hold_piece(&held);
+		if(held.mode == MODE_STAGE && held.piece.type != g->piece.type) {
+			count = search_piece(&held, held.piece, true, h, params, linesBefore,
+				out, count, max);
+		}
+	}
+	return count;
+}
+
+int search_placements(const GameState *g, Heuristic h, const void *params,
+		Placement *out, int max) {
+	return search_all(g, h, params, 0, out, max);
+}
+
+bool search_best(const GameState *g, Heuristic h, const void *params, Placement *best) {
+	Placement placements[MAX_PLACEMENTS];
+	int count = search_placements(g, h, params, placements, MAX_PLACEMENTS);
+	if(count == 0) return false;
+	int b = 0;
+	for(int i = 1; i < count; i++) {
+		if(placements[i].score > placements[b].score) b = i;
+	}
+	*best = placements[b];
+	return true;
+}
+
+// Carried down through a lookahead
+typedef struct {
+	Heuristic h;
+	const void *params;
+	TransTable *table;
+	TransStats stats;
+	Uint64 placements;
+} Lookahead;
+
+// Best score placing depth more pieces from g. Different orders of
+// placements often end up at the same position, the table makes sure each
+// one is only searched once
+static int lookahead_score(Lookahead *l, const GameState *g, int depth, int lines) {
+	// The lines cleared so far are part of every score under here, so they
+	// are part of the key along with how deep it was searched
+	Uint64 key = game_hash(g) + (Uint64)(depth << 8 | lines) * 0x9E3779B97F4A7C15ull;
+	int best;
+	if(l->table && trans_probe(l->table, key, &best, &l->stats)) return best;
+	Placement placements[MAX_PLACEMENTS];
+	int count = search_all(g, l->h, l->params, lines, placements, MAX_PLACEMENTS);
+	l->placements += count;
+	best = SCORE_TOP_OUT;
+	for(int i = 0; i < count; i++) {
+		int score = placements[i].score;
+		if(depth > 1 && score > SCORE_TOP_OUT) {
+			GameState next = *g;
+			search_apply(&next, &placements[i]);
+			score = next.mode != MODE_STAGE ? SCORE_TOP_OUT :
+				lookahead_score(l, &next, depth - 1, lines + placements[i].linesCleared);
+		}
+		if(score > best) best = score;
+	}
+	if(l->table) trans_store(l->table, key, best, &l->stats);
+	return best;
+}
+
+int search_lookahead(const GameState *g, Heuristic h, const void *params, int depth,
+		TransTable *table, Placement *best) {
+	Lookahead l = { h, params, table, { 0 }, 0 };
+	Placement placements[MAX_PLACEMENTS];
+	int count = search_all(g, h, params, 0, placements, MAX_PLACEMENTS);
+	l.placements = count;
+	if(depth > MAX_LOOKAHEAD) depth = MAX_LOOKAHEAD;
+	int b = -1;
+	for(int i = 0; i < count; i++) {
+		Placement *p = &placements[i];
+		if(depth > 1 && p->score > SCORE_TOP_OUT) {
+			GameState next = *g;
+			search_apply(&next, p);
+			p->score = next.mode != MODE_STAGE ? SCORE_TOP_OUT :
+				lookahead_score(&l, &next, depth - 1, p->linesCleared);
+		}
+		if(b < 0 || p->score > placements[b].score) b = i;
+	}
+	if(table) trans_add_stats(table, &l.stats);
+	if(b >= 0) *best = placements[b];
+	return l.placements;
+}
+
+void search_apply(GameState *g, const Placement *p) {
+	for(int i = 0; i < p->pathLength; i++) {
+		switch(p->path[i]) {
+			case MOVE_LEFT: move_piece_left(g); break;
+			case MOVE_RIGHT: move_piece_right(g); break;
+			case MOVE_ROTATE_LEFT: rotate_piece_left(g); break;
+			case MOVE_ROTATE_RIGHT: rotate_piece_right(g); break;
+			case MOVE_DOWN: move_piece_down(g); break;
+			case MOVE_SOFT_DROP:
+			while(!check_lock(g, g->piece)) move_piece_down(g);
+			break;
+			case MOVE_HARD_DROP: hard_drop(g); break;
+			case MOVE_HOLD: hold_piece(g); break;
+		}
+	}
+}
+
+void bot_init(BotController *c, Heuristic h, const void *params) {
+	memset(c, 0, sizeof(BotController));
+	c->h = h;
+	c->params = params;
+	c->depth = 1;
+}
+
+static bool same_piece(Piece a, Piece b) {
+	return a.x == b.x && a.y == b.y && a.type == b.type && a.flip == b.flip;
+}
+
+// Searches again from wherever the piece is now
+static void bot_plan(BotController *c, const GameState *g) {
+	int count;
+	c->searches++;
+	c->step = 0;
+	c->pieces = g->pieces;
+	c->planned = true;
+	if(c->depth > 1) {
+		count = search_lookahead(g, c->h, c->params, c->depth, c->table, &c->plan);
+		c->placements += count;
+	} else {
+		Placement placements[MAX_PLACEMENTS];
+		count = search_placements(g, c->h, c->params, placements, MAX_PLACEMENTS);
+		c->placements += count;
+		int best = 0;
+		for(int i = 1; i < count; i++) {
+			if(placements[i].score > placements[best].score) best = i;
+		}
+		if(count > 0) c->plan = placements[best];
+	}
+	if(count == 0) {
+		// Nowhere good to go, just drop it
+		c->plan.pathLength = 1;
+		c->plan.path[0] = MOVE_HARD_DROP;
+	}
+}
+
+bool bot_needs_plan(const BotController *c, const GameState *g) {
+	if(g->mode != MODE_STAGE || c->dropping || c->releasing) return false;
+	return !c->planned || c->pieces != g->pieces || c->step >= c->plan.pathLength;
+}
+
+InputBits bot_input(BotController *c, const GameState *g) {
+	if(g->mode != MODE_STAGE) return 0;
+	// The last piece locked, whatever was left of the plan is stale
+	if(c->pieces != g->pieces) c->planned = false;
+	if(c->dropping) {
+		if(!check_lock(g, g->piece)) return INPUT_DOWN;
+		// Landed, let go of down before it locks the piece
+		c->dropping = false;
+		c->step++;
+		if(!same_piece(g->piece, c->expect)) c->planned = false;
+		return 0;
+	}
+	if(c->releasing) {
+		c->releasing = false;
+		if(!same_piece(g->piece, c->expect)) c->planned = false;
+		return 0;
+	}
+	if(!c->planned || c->step >= c->plan.pathLength) bot_plan(c, g);
+	int move = c->plan.path[c->step];
+	c->expect = g->piece;
+	switch(move) {
+		case MOVE_HOLD: {
+			GameState held = *g;
+			hold_piece(&held);
+			c->expect = held.piece;
+			c->step++;
+			c->releasing = true;
+			return INPUT_SHIFT;
+		}
+		case MOVE_HARD_DROP:
+		c->planned = false;
+		c->releasing = true;
+		return INPUT_SPACE;
+		case MOVE_SOFT_DROP:
+		try_move(g, &c->expect, MOVE_SOFT_DROP);
+		c->dropping = true;
+		return INPUT_DOWN;
+	}
+	try_move(g, &c->expect, move);
+	c->step++;
+	c->releasing = true;
+	switch(move) {
+		case MOVE_LEFT: return INPUT_LEFT;
+		case MOVE_RIGHT: return INPUT_RIGHT;
+		case MOVE_ROTATE_LEFT: return INPUT_Z;
+		case MOVE_ROTATE_RIGHT: return INPUT_X;
+		default: return INPUT_DOWN;
+	}
+}
@@ -0,0 +1,121 @@
+#ifndef TETRIS_SEARCH
+#define TETRIS_SEARCH
+
+#include "game.h"
+#include "trans.h"
+
+// Longest input path the search will keep for a placement
+#define MAX_PATH 32
+// Enough room for every placement of the current piece and the hold piece
+#define MAX_PLACEMENTS 512
+// Deepest search_lookahead goes, the current piece and the whole queue
+#define MAX_LOOKAHEAD 6
+
+// Moves a path is made of, each one maps onto one of the game's actions
+enum {
+	MOVE_LEFT,         // move_piece_left
+	MOVE_RIGHT,        // move_piece_right
+	MOVE_ROTATE_LEFT,  // rotate_piece_left
+	MOVE_ROTATE_RIGHT, // rotate_piece_right
+	MOVE_DOWN,         // move_piece_down by one row without locking
+	MOVE_SOFT_DROP,    // move_piece_down until the piece rests, without locking
+	MOVE_HARD_DROP,    // hard_drop, always the last move of a path
+	MOVE_HOLD          // hold_piece, only ever the first move of a path
+};
+
+// A final resting position and the moves that get the piece there
+typedef struct {
+	Piece piece;
+	// Heuristic score of the stage after locking, higher is better
+	int score;
+	Uint8 linesCleared;
+	Uint8 pathLength;
+	Uint8 path[MAX_PATH];
+} Placement;
+
+// Things about a stage that heuristics usually care about
+typedef struct {
+	// Sum of the column heights, and the tallest column
+	int height, maxHeight;
+	// Empty cells with a block somewhere above them
+	int holes;
+	// Sum of height differences between neighbouring columns
+	int bumpiness;
+} BoardFeatures;
+
+// Scores a stage after a placement was locked and its lines cleared, the
+// first size.height rows are the stage. params is passed through untouched
+// from search_placements
+typedef int (*Heuristic)(const Row *rows, StageSize size, int linesCleared, const void *params);
+
+// Weights for heuristic_weighted, each feature is multiplied and summed
+typedef struct {
+	int height, holes, bumpiness, lines;
+} HeuristicWeights;
+
+extern const HeuristicWeights DefaultWeights;
+
+void board_features(const Row *rows, StageSize size, BoardFeatures *f);
+
+// Weighted sum of board_features, params is a HeuristicWeights
+int heuristic_weighted(const Row *rows, StageSize size, int linesCleared, const void *params);
+
+// Finds every placement reachable by the current piece, and by the hold
+// piece (or queue[0] if nothing is held) when holding is allowed. Moves
+// follow the same rules as the game's actions, so tucks and kicks count.
+// Returns the number of placements written to out, at most max, and no
+// more than 1022 for either piece however big max is
+int search_placements(const GameState *g, Heuristic h, const void *params,
+	Placement *out, int max);
+
+// Highest scoring placement, returns false if there are none
+bool search_best(const GameState *g, Heuristic h, const void *params, Placement *best);
+
+// Like search_best, but scores each placement by the best stage reachable
+// placing depth - 1 more pieces after it, from the queue and the hold.
+// Heuristics are given every line cleared on the way. Positions already
+// in table aren't searched again, whatever order of placements reached
+// them. table may be NULL, and has to be used with one heuristic only.
+// Returns the number of placements enumerated, 0 if there was nowhere to go
+int search_lookahead(const GameState *g, Heuristic h, const void *params, int depth,
+	TransTable *table, Placement *best);
+
+// Plays a placement's path on the game, ending with the piece locked
+void search_apply(GameState *g, const Placement *p);
+
+// Plays the best placement for each piece one key press at a time through
+// game_step, so bot games can be recorded and watched like a player's
+typedef struct {
+	Heuristic h;
+	const void *params;
+	// Pieces looked ahead, 1 only places the current one. Set after bot_init
+	int depth;
+	// Cache shared with other bots using the same heuristic, or NULL
+	TransTable *table;
+	Placement plan;
+	// Next move of the plan, and whether there is a plan at all
+	int step;
+	bool planned;
+	// Last frame pressed a key so this frame lets go of it
+	bool releasing;
+	// Holding down until the piece lands, for MOVE_SOFT_DROP
+	bool dropping;
+	// Where the piece should be after the last key press, if gravity or
+	// anything else moved it the rest of the plan can't be trusted
+	Piece expect;
+	// Piece count the plan was made for
+	Uint32 pieces;
+	// Searches run and placements they found
+	Uint64 searches, placements;
+} BotController;
+
+void bot_init(BotController *c, Heuristic h, const void *params);
+
+// Keys to hold for the next frame of g
+InputBits bot_input(BotController *c, const GameState *g);
+
+// Whether bot_input will search for a new plan this frame, which costs
+// far more than any other frame
+bool bot_needs_plan(const BotController *c, const GameState *g);
+
+#endif
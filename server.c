@@ -0,0 +1,393 @@
+// Hosts many independent games in one process for clients on a Unix domain
+// socket. Each connection is a session that sends its keys a frame at a
+// time and gets back only what changed. Every session is stepped together
+// in ticks, all from one epoll loop on one thread
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "game.h"
+#include "protocol.h"
+
+#define DEFAULT_SOCKET "tetris.sock"
+// Ticks a second, 0 steps sessions as soon as their input arrives instead
+#define DEFAULT_RATE 60
+#define DEFAULT_SESSIONS 4096
+#define MAX_SESSIONS (1 << 20)
+// Frames of input a session can have waiting, clients must not send more
+#define INPUT_QUEUE 64
+// Unparsed input, and deltas not written yet. A client that doesn't read
+// its deltas until they fill the buffer is dropped
+#define IN_BUFFER 512
+#define OUT_BUFFER 4096
+#define EPOLL_EVENTS 256
+// Epoll tag of the listening socket, sessions are tagged with their index
+#define LISTENER 0xFFFFFFFF
+// How often the stats are printed
+#define REPORT_NS 5000000000ull
+
+typedef struct {
+	int fd;
+	// Place in the active list
+	int slot;
+	// Started by MSG_START, and whether the client still needs a delta
+	// even if no frames were stepped
+	bool started, dirty;
+	// Waiting on the socket to take more of out
+	bool writing;
+	// Input ran out in free running mode and more has come in since
+	bool ready;
+	GameState game;
+	// What the client has been sent so far
+	SessionView sent;
+	InputBits last;
+	InputBits queue[INPUT_QUEUE];
+	int head, count;
+	int inSize, outSize;
+	Uint8 in[IN_BUFFER];
+	Uint8 out[OUT_BUFFER];
+} Session;
+
+// Every session slot, and the slots in use packed together so each tick
+// only walks live sessions
+Session *sessions;
+int *active, activeCount;
+int *freeSlots, freeCount;
+// Sessions with input to step, only used when not ticking at a fixed rate
+int *readyList, readyCount;
+int epollFd, listenFd;
+int rate, capacity;
+volatile sig_atomic_t running = 1;
+// Totals since the last report
+Uint64 framesStepped, bytesOut, messagesOut, turnedAway;
+
+static void stop(int signal) {
+	running = 0;
+}
+
+static bool set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+int open_listener(const char *path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1 || !set_nonblocking(fd)) {
+		perror("socket");
+		return -1;
+	}
+	// Left behind by a server that didn't shut down cleanly
+	unlink(path);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void close_session(int i) {
+	Session *s = &sessions[i];
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, s->fd, NULL);
+	close(s->fd);
+	s->fd = -1;
+	// Waiting to be stepped, the slot could be taken again before then.
+	// tick clears ready first, so this never runs while it walks the list
+	if(s->ready) {
+		int k = 0;
+		while(readyList[k] != i) k++;
+		readyList[k] = readyList[--readyCount];
+		s->ready = false;
+	}
+	// Swap the last active session into this one's place
+	int last = active[--activeCount];
+	active[s->slot] = last;
+	sessions[last].slot = s->slot;
+	freeSlots[freeCount++] = i;
+}
+
+void accept_clients() {
+	for(;;) {
+		int fd = accept(listenFd, NULL, NULL);
+		if(fd == -1) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+			return;
+		}
+		if(freeCount == 0 || !set_nonblocking(fd)) {
+			close(fd);
+			turnedAway++;
+			continue;
+		}
+		int i = freeSlots[--freeCount];
+		Session *s = &sessions[i];
+		memset(s, 0, offsetof(Session, in));
+		s->fd = fd;
+		s->slot = activeCount;
+		active[activeCount++] = i;
+		struct epoll_event event = { .events = EPOLLIN, .data.u32 = i };
+		if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+			perror("epoll_ctl");
+			close_session(i);
+		}
+	}
+}
+
+// Writes as much of the session's deltas as the socket takes, and waits
+// for it to take the rest. False if the client has gone
+bool flush_session(int i) {
+	Session *s = &sessions[i];
+	if(s->outSize > 0) {
+		ssize_t n = send(s->fd, s->out, s->outSize, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) return false;
+		if(n > 0) {
+			s->outSize -= n;
+			memmove(s->out, s->out + n, s->outSize);
+		}
+	}
+	bool waiting = s->outSize > 0;
+	if(waiting != s->writing) {
+		struct epoll_event event = { .events = EPOLLIN | (waiting ? EPOLLOUT : 0), .data.u32 = i };
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, s->fd, &event);
+		s->writing = waiting;
+	}
+	return true;
+}
+
+// Handles every whole message in the input buffer. False if the client
+// broke the protocol
+bool parse_messages(int i) {
+	Session *s = &sessions[i];
+	int pos = 0;
+	while(pos < s->inSize) {
+		const Uint8 *m = s->in + pos;
+		int left = s->inSize - pos;
+		if(m[0] == MSG_START) {
+			if(left < 9) break;
+			Uint64 seed = 0;
+			for(int b = 7; b >= 0; b--) seed = seed << 8 | m[1 + b];
+			game_seed(&s->game, seed);
+			// The client starts again from an empty view too
+			memset(&s->sent, 0, sizeof(SessionView));
+			s->last = 0;
+			s->count = 0;
+			s->started = s->dirty = true;
+			pos += 9;
+		} else if(m[0] == MSG_INPUT) {
+			if(left < 2 || left < 2 + m[1] * 2) break;
+			if(!s->started || s->count + m[1] > INPUT_QUEUE) return false;
+			for(int k = 0; k < m[1]; k++) {
+				s->queue[(s->head + s->count++) % INPUT_QUEUE] = m[2 + k * 2] | m[3 + k * 2] << 8;
+			}
+			pos += 2 + m[1] * 2;
+		} else {
+			return false;
+		}
+	}
+	s->inSize -= pos;
+	memmove(s->in, s->in + pos, s->inSize);
+	if(rate == 0 && (s->count > 0 || s->dirty) && !s->ready && readyCount < capacity) {
+		s->ready = true;
+		readyList[readyCount++] = i;
+	}
+	return true;
+}
+
+// False if the client has gone or broke the protocol
+bool read_session(int i) {
+	Session *s = &sessions[i];
+	for(;;) {
+		ssize_t n = read(s->fd, s->in + s->inSize, IN_BUFFER - s->inSize);
+		if(n == 0) return false;
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		s->inSize += n;
+		if(!parse_messages(i)) return false;
+		// A full buffer that didn't parse can only be garbage
+		if(s->inSize == IN_BUFFER) return false;
+	}
+}
+
+// Steps one session and queues the delta for its client. At a fixed rate
+// that is one frame, held on the last keys if no input came in time.
+// Otherwise it is every frame the client has sent input for
+bool step_session(int i) {
+	Session *s = &sessions[i];
+	if(!s->started) return true;
+	int frames = 0, consumed = 0;
+	do {
+		if(s->count > 0) {
+			s->last = s->queue[s->head];
+			s->head = (s->head + 1) % INPUT_QUEUE;
+			s->count--;
+			consumed++;
+		} else if(rate == 0) {
+			break;
+		}
+		game_step(&s->game, s->last);
+		frames++;
+	} while(rate == 0 && frames < 255);
+	if(frames == 0 && !s->dirty) return true;
+	if(s->outSize + FRAME_MSG_MAX > OUT_BUFFER) return false;
+	SessionView now;
+	view_update(&now, &s->game);
+	now.frames = s->sent.frames + frames;
+	int length = delta_encode(s->out + s->outSize, &s->sent, &now, frames, consumed);
+	s->sent = now;
+	s->outSize += length;
+	s->dirty = false;
+	framesStepped += frames;
+	bytesOut += length;
+	messagesOut++;
+	return true;
+}
+
+// Steps every session in one batch, then writes out what they produced
+void tick() {
+	if(rate == 0) {
+		for(int k = 0; k < readyCount; k++) {
+			int i = readyList[k];
+			sessions[i].ready = false;
+			if(!step_session(i) || !flush_session(i)) close_session(i);
+		}
+		readyCount = 0;
+		return;
+	}
+	for(int k = 0; k < activeCount; k++) {
+		int i = active[k];
+		if(step_session(i) && flush_session(i)) continue;
+		// The session swapped in from the end takes this place
+		close_session(i);
+		k--;
+	}
+}
+
+void handle_event(struct epoll_event *event) {
+	if(event->data.u32 == LISTENER) {
+		accept_clients();
+		return;
+	}
+	int i = event->data.u32;
+	if(sessions[i].fd == -1) return;
+	bool ok = !(event->events & (EPOLLERR | EPOLLHUP)) || (event->events & EPOLLIN);
+	if(ok && event->events & EPOLLIN) ok = read_session(i);
+	if(ok && event->events & EPOLLOUT) ok = flush_session(i);
+	if(!ok) close_session(i);
+}
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-s socket] [-r ticks per second] [-m max sessions]\n", name);
+	fprintf(stderr, "  -r 0 steps each session as soon as its input arrives\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = DEFAULT_SOCKET;
+	capacity = DEFAULT_SESSIONS;
+	rate = DEFAULT_RATE;
+	for(int i = 1; i < argc; i++) {
+		if(i + 1 < argc && strcmp(argv[i], "-s") == 0) path = argv[++i];
+		else if(i + 1 < argc && strcmp(argv[i], "-r") == 0) rate = atoi(argv[++i]);
+		else if(i + 1 < argc && strcmp(argv[i], "-m") == 0) capacity = atoi(argv[++i]);
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(rate < 0 || capacity < 1 || capacity > MAX_SESSIONS) {
+		usage(argv[0]);
+		return 1;
+	}
+	sessions = malloc(capacity * sizeof(Session));
+	active = malloc(capacity * sizeof(int));
+	freeSlots = malloc(capacity * sizeof(int));
+	readyList = malloc(capacity * sizeof(int));
+	if(!sessions || !active || !freeSlots || !readyList) {
+		fprintf(stderr, "Out of memory for %d sessions\n", capacity);
+		return 1;
+	}
+	// Lowest slots first
+	for(int i = 0; i < capacity; i++) {
+		sessions[i].fd = -1;
+		freeSlots[i] = capacity - 1 - i;
+	}
+	freeCount = capacity;
+	listenFd = open_listener(path);
+	epollFd = epoll_create1(0);
+	if(listenFd == -1 || epollFd == -1) return 1;
+	struct epoll_event event = { .events = EPOLLIN, .data.u32 = LISTENER };
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+	struct sigaction action = { .sa_handler = stop };
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	printf("Listening on %s, %d sessions at most, ", path, capacity);
+	if(rate) printf("%d ticks a second\n", rate);
+	else printf("stepping as input arrives\n");
+	fflush(stdout);
+
+	struct epoll_event events[EPOLL_EVENTS];
+	Uint64 step = rate ? 1000000000ull / rate : 0;
+	Uint64 next = now_ns() + step, lastReport = now_ns();
+	while(running) {
+		int timeout = -1;
+		if(rate) {
+			Uint64 now = now_ns();
+			timeout = next > now ? (next - now + 999999) / 1000000 : 0;
+		} else if(readyCount > 0) {
+			timeout = 0;
+		}
+		int n = epoll_wait(epollFd, events, EPOLL_EVENTS, timeout);
+		if(n == -1 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for(int k = 0; k < n; k++) handle_event(&events[k]);
+		Uint64 now = now_ns();
+		if(rate == 0) {
+			tick();
+		} else if(now >= next) {
+			tick();
+			next += step;
+			// Fell more than a tick behind, skip ahead rather than burst
+			if(now > next + step) next = now + step;
+		}
+		if(now - lastReport >= REPORT_NS) {
+			double seconds = (now - lastReport) / 1e9;
+			printf("%d sessions, %.0f frames/s, %.0f messages/s, %.1f bytes/frame out",
+				activeCount, framesStepped / seconds, messagesOut / seconds,
+				framesStepped ? (double)bytesOut / framesStepped : 0);
+			if(turnedAway) printf(", %llu turned away", (unsigned long long)turnedAway);
+			printf("\n");
+			fflush(stdout);
+			framesStepped = bytesOut = messagesOut = turnedAway = 0;
+			lastReport = now;
+		}
+	}
+	while(activeCount > 0) close_session(active[0]);
+	close(listenFd);
+	close(epollFd);
+	unlink(path);
+	free(sessions);
+	free(active);
+	free(freeSlots);
+	free(readyList);
+	return 0;
+}
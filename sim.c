@@ -0,0 +1,223 @@
+// Headless batch runner, plays games back to back without a window or
+// frame limiter and prints throughput at the end. Can also record every
+// game as a replay, or play replays back to check their scores
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+#include "replay.h"
+#include "runner.h"
+#include "search.h"
+
+// Stop a game after this many frames even if it hasn't topped out
+#define DEFAULT_MAX_FRAMES (60 * 60 * 10)
+// Games played by the bot stop after this many pieces instead
+#define DEFAULT_MAX_PIECES 10000
+// Longest replay filename, directory included
+#define MAX_FILENAME 256
+// Positions the bot's lookahead cache holds, as a power of 2
+#define DEFAULT_CACHE_BITS 20
+
+// What plays the games
+#define DRIVER_RANDOM 0
+#define DRIVER_BOT 1
+
+// Settings shared by every game of a run
+typedef struct {
+	int driver;
+	Uint64 seed;
+	StageSize stage;
+	Uint32 maxFrames, maxPieces;
+	// Pieces the bot looks ahead, and the cache every game's bot shares
+	int depth;
+	TransTable *table;
+	// Directory to record replays into, NULL to not record
+	const char *record;
+	// Replays to verify instead of playing new games
+	char **replays;
+} SimOptions;
+
+// Plays one whole game, runs on the runner's worker threads
+void play_game(int index, GameResult *result, void *ctx) {
+	const SimOptions *o = ctx;
+	GameState game;
+	*result = (GameResult){ 0 };
+	// Game i always gets seed + i, so results don't depend on which thread
+	// played it, and any single game can be played again on its own
+	Uint64 seed = o->seed + index;
+	game_setup(&game, seed, o->stage);
+	ReplayWriter replay = { NULL };
+	if(o->record) {
+		char filename[MAX_FILENAME];
+		snprintf(filename, sizeof(filename), "%s/%llu.trp", o->record,
+			(unsigned long long)seed);
+		replay_record(&replay, filename, seed, o->stage);
+	}
+	if(o->driver == DRIVER_BOT) {
+		// Played through game_step like a person would, so it can be recorded
+		BotController bot;
+		bot_init(&bot, heuristic_weighted, &DefaultWeights);
+		bot.depth = o->depth;
+		bot.table = o->table;
+		while(game.mode == MODE_STAGE && game.pieces < o->maxPieces) {
+			InputBits input = bot_input(&bot, &game);
+			replay_frame(&replay, &game, input);
+			game_step(&game, input);
+		}
+		result->searches = bot.searches;
+		result->placements = bot.placements;
+	} else {
+		Uint32 inputState = random_input_seed(seed);
+		InputBits input = 0;
+		while(game.mode == MODE_STAGE && game.frames < o->maxFrames) {
+			input = random_input(&inputState, input);
+			replay_frame(&replay, &game, input);
+			game_step(&game, input);
+		}
+	}
+	replay_finish(&replay, &game);
+	result->score = game.score;
+	result->lines = game.totalLines;
+	result->pieces = game.pieces;
+	result->frames = game.frames;
+}
+
+// Plays a replay back and checks it ends the way it was recorded. One
+// that doesn't, or can't be loaded, fails and is left out of the stats
+void verify_game(int index, GameResult *result, void *ctx) {
+	const SimOptions *o = ctx;
+	GameState game;
+	Replay replay;
+	*result = (GameResult){ .failed = true };
+	if(!replay_load(&replay, o->replays[index])) {
+		printf("%s: can't be loaded\n", o->replays[index]);
+		return;
+	}
+	bool ok = replay_verify(&replay, &game);
+	replay_free(&replay);
+	if(!ok) {
+		printf("%s: expected score %d after %u frames, got %d after %u\n",
+			o->replays[index], replay.summary.score, replay.summary.frames,
+			game.score, game.frames);
+		return;
+	}
+	result->failed = false;
+	result->score = game.score;
+	result->lines = game.totalLines;
+	result->pieces = game.pieces;
+	result->frames = game.frames;
+}
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-n games] [-s seed] [-f max frames] "
+		"[-p max pieces] [-d random|bot] [-l lookahead] [-c cache bits] [-j threads] "
+		"[-b WxH[+hidden]] [-r replay dir]\n"
+		"       %s [-j threads] -v replay...\n", name, name);
+}
+
+int main(int argc, char *argv[]) {
+	int games = 1000, threads = runner_cpu_count();
+	SimOptions o = {
+		.driver = DRIVER_RANDOM, .seed = 1, .stage = StandardStage,
+		.maxFrames = DEFAULT_MAX_FRAMES, .maxPieces = DEFAULT_MAX_PIECES, .depth = 1
+	};
+	int cacheBits = DEFAULT_CACHE_BITS;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+			// Everything after -v is a replay
+			o.replays = &argv[i + 1];
+			games = argc - i - 1;
+			break;
+		} else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			o.record = argv[++i];
+		} else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			games = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			o.seed = strtoull(argv[++i], NULL, 0);
+		} else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			o.maxFrames = strtoul(argv[++i], NULL, 0);
+		} else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			o.maxPieces = strtoul(argv[++i], NULL, 0);
+		} else if(strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			o.depth = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			cacheBits = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			if(!stage_size_parse(argv[++i], &o.stage)) {
+				fprintf(stderr, "%s: stages are 4x4 up to %dx%d, or 10x40\n",
+					argv[0], MAX_STAGE_W, MAX_STAGE_H);
+				return 1;
+			}
+		} else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			i++;
+			if(strcmp(argv[i], "bot") == 0) o.driver = DRIVER_BOT;
+			else if(strcmp(argv[i], "random") == 0) o.driver = DRIVER_RANDOM;
+			else { usage(argv[0]); return 1; }
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(games < 1) games = 1;
+	if(o.depth < 1 || o.depth > MAX_LOOKAHEAD || cacheBits < 0 || cacheBits > 32) {
+		usage(argv[0]);
+		return 1;
+	}
+	GameResult *results = malloc(games * sizeof(GameResult));
+	if(!results) return 1;
+	// Only a lookahead reaches the same position more than one way
+	TransTable table;
+	if(o.depth > 1 && cacheBits > 0) {
+		if(!trans_init(&table, cacheBits)) return 1;
+		o.table = &table;
+	}
+	RunnerReport report;
+	RunStats stats;
+	runner_run(games, threads, o.replays ? verify_game : play_game, &o, results, &report);
+	runner_stats(results, games, &stats);
+	double seconds = report.seconds > 0 ? report.seconds : 1e-9;
+	int failed = 0;
+	if(o.replays) {
+		for(int i = 0; i < games; i++) failed += results[i].failed;
+		printf("verify: %d of %d replays match\n", games - failed, games);
+	}
+	printf("games:  %d in %.3f s on %d threads (%.1f games/s)\n",
+		games, seconds, report.threads, games / seconds);
+	// Failed games are left out, and if every one failed there is nothing to show
+	if(stats.games > 0) {
+		printf("frames: %llu (%.0f frames/s, %.0fx realtime)\n", (unsigned long long)stats.frames,
+			stats.frames / seconds, stats.frames / seconds / 60);
+		printf("pieces: %llu (%.0f pieces/s), lines: %llu\n",
+			(unsigned long long)stats.pieces.total, stats.pieces.total / seconds,
+			(unsigned long long)stats.lines.total);
+		printf("score:  %.1f average, %d min, %d max\n",
+			stats.score.mean, stats.score.min, stats.score.max);
+		printf("lines:  %.1f average, %d min, %d max\n",
+			stats.lines.mean, stats.lines.min, stats.lines.max);
+	}
+	if(stats.searches > 0) {
+		printf("search: %llu placements from %llu searches (%.0f placements/s)\n",
+			(unsigned long long)stats.placements, (unsigned long long)stats.searches,
+			stats.placements / seconds);
+	}
+	if(o.table) {
+		printf("cache:  %llu lookups, %.1f%% hits, %llu stored\n",
+			(unsigned long long)atomic_load(&table.probes), 100 * trans_hit_rate(&table),
+			(unsigned long long)atomic_load(&table.stores));
+		trans_free(&table);
+	}
+	if(report.threads > 1) {
+		// How evenly the games ended up spread
+		printf("threads:");
+		for(int i = 0; i < report.threads; i++) {
+			printf(" %d/%d", report.played[i], report.steals[i]);
+		}
+		printf(" (games played/steals)\n");
+	}
+	free(results);
+	return failed > 0;
+}
@@ -0,0 +1,135 @@
+// Headless checks of the game core, each one plays a game through
+// game_step the way tetris-sim does and fails on anything that comes out
+// different from what a player would see. make test runs them all
+
+#include <stdio.h>
+
+#include "game.h"
+#include "replay.h"
+
+#define TEST_SEED 1
+// Frames hard dropping takes to top out, with room to spare
+#define MAX_DROP_FRAMES 1000
+
+// Hard drops every other frame until the game is over, false if it never is
+static bool top_out(GameState *g) {
+	for(int i = 0; i < MAX_DROP_FRAMES && g->mode != MODE_GAMEOVER; i++) {
+		game_step(g, i & 1 ? 0 : INPUT_SPACE);
+	}
+	return g->mode == MODE_GAMEOVER;
+}
+
+static void set_block(GameState *g, int x, int y, int type) {
+	Row old = g->stage.rows[y];
+	g->stage.rows[y] |= 1 << x;
+	g->stage.hash ^= zobrist_row(y, old) ^ zobrist_row(y, g->stage.rows[y]);
+	g->stage.color[y][x] = type + 1;
+	if(y < g->stage.surface[x]) g->stage.surface[x] = y;
+}
+
+// A line clear moves down everything above it, rows above an empty row
+// inside the stack included
+static int test_clear_gap() {
+	GameState g;
+	game_seed(&g, TEST_SEED);
+	int bottom = STAGE_H - 1;
+	// The bottom row full but for where an O goes, an empty row above the
+	// O and a block over that
+	for(int x = 2; x < STAGE_W; x++) set_block(&g, x, bottom, 0);
+	set_block(&g, 5, bottom - 3, 0);
+	Uint64 hash = g.stage.hash;
+	const PieceShape *s = &PieceShapes[0][0];
+	g.piece = (Piece){ -s->minX, bottom - s->maxY, 0, 0 };
+	lock_piece(&g);
+	int failed = 0;
+	if(g.linesCleared != 1) {
+		fprintf(stderr, "clear_gap: %d lines cleared instead of 1\n", g.linesCleared);
+		return 1;
+	}
+	const Row want[] = { 1 << 5, 0, 3 };
+	for(int i = 0; i < 3; i++) {
+		int y = bottom - 2 + i;
+		if(g.stage.rows[y] != want[i]) {
+			fprintf(stderr, "clear_gap: row %d is %#x instead of %#x\n", y, g.stage.rows[y], want[i]);
+			failed++;
+		}
+	}
+	if(g.stage.rows[bottom - 3] != 0 || g.stage.surface[5] != bottom - 2) {
+		fprintf(stderr, "clear_gap: the block above the gap didn't move down\n");
+		failed++;
+	}
+	// The same rows built up by hand hash the same
+	GameState h;
+	game_seed(&h, TEST_SEED);
+	set_block(&h, 5, bottom - 2, 0);
+	set_block(&h, 0, bottom, 0);
+	set_block(&h, 1, bottom, 0);
+	if(g.stage.hash != h.stage.hash || g.stage.hash == hash) {
+		fprintf(stderr, "clear_gap: stage hash not kept up to date\n");
+		failed++;
+	}
+	return failed;
+}
+
+// Enter held down from the game over screen into the new game starts it
+// without pausing, and other keys held through it stay held
+static int test_restart_held() {
+	GameState g;
+	game_seed(&g, TEST_SEED);
+	if(!top_out(&g)) {
+		fprintf(stderr, "restart_held: the game never ends\n");
+		return 1;
+	}
+	int failed = 0;
+	for(int i = 0; i < 60; i++) game_step(&g, INPUT_ENTER | INPUT_LEFT);
+	if(g.mode != MODE_STAGE || g.paused) {
+		fprintf(stderr, "restart_held: mode %d paused %d after holding enter\n", g.mode, g.paused);
+		failed++;
+	}
+	if(g.keys != (INPUT_ENTER | INPUT_LEFT)) {
+		fprintf(stderr, "restart_held: keys are %#x while enter and left are held\n", g.keys);
+		failed++;
+	}
+	// Let go, and the next press pauses like always
+	game_step(&g, 0);
+	game_step(&g, INPUT_ENTER);
+	if(!g.paused) {
+		fprintf(stderr, "restart_held: pressing enter again doesn't pause\n");
+		failed++;
+	}
+	return failed;
+}
+
+// Replays recorded by version 1 and 2 builds, before game_step took key
+// events. Keys are mashed two and three at a time, and enter is held from
+// the game over screen into the next game, twice
+const char *OldReplays[] = { "tests/replay-v1.trp", "tests/replay-v2.trp" };
+
+// Old replays still play back to the same end
+static int test_old_replays() {
+	int failed = 0;
+	for(int i = 0; i < 2; i++) {
+		Replay r;
+		GameState g;
+		if(!replay_load(&r, OldReplays[i])) {
+			fprintf(stderr, "old_replays: can't load %s\n", OldReplays[i]);
+			failed++;
+			continue;
+		}
+		if(!replay_verify(&r, &g)) {
+			fprintf(stderr, "old_replays: %s ends with score %d after %u frames instead of %d after %u\n",
+				OldReplays[i], g.score, r.frame, r.summary.score, r.summary.frames);
+			failed++;
+		}
+		replay_free(&r);
+	}
+	return failed;
+}
+
+int main() {
+	int failed = test_restart_held();
+	failed += test_clear_gap();
+	failed += test_old_replays();
+	if(failed) fprintf(stderr, "%d checks failed\n", failed);
+	return failed > 0;
+}
@@ -0,0 +1,38 @@
+#include "timer.h"
+
+Uint64 frequency;
+Uint64 spinTicks;
+
+void timer_init() {
+	frequency = SDL_GetPerformanceFrequency();
+	spinTicks = timer_from_us(TIMER_SPIN_US);
+}
+
+Uint64 timer_now() {
+	return SDL_GetPerformanceCounter();
+}
+
+Uint64 timer_frequency() {
+	return frequency;
+}
+
+Uint64 timer_to_us(Uint64 ticks) {
+	// Split so the multiply can't overflow for long uptimes
+	return ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency;
+}
+
+Uint64 timer_from_us(Uint64 us) {
+	return us / 1000000 * frequency + us % 1000000 * frequency / 1000000;
+}
+
+void timer_wait_until(Uint64 deadline) {
+	Uint64 now = timer_now();
+	// Compare the difference, never subtract the other way round
+	while(now < deadline && deadline - now > spinTicks) {
+		Uint32 ms = timer_to_us(deadline - now - spinTicks) / 1000;
+		if(ms == 0) break;
+		SDL_Delay(ms);
+		now = timer_now();
+	}
+	while(now < deadline) now = timer_now();
+}
@@ -0,0 +1,28 @@
+#ifndef TETRIS_TIMER
+#define TETRIS_TIMER
+
+#include <SDL2/SDL.h>
+
+// Waits shorter than this spin instead of sleeping, sleeps can overshoot
+// by a millisecond or more depending on the OS scheduler
+#define TIMER_SPIN_US 2000
+
+// Reads the performance counter frequency, call before anything else
+void timer_init();
+
+// Current time in performance counter ticks
+Uint64 timer_now();
+
+// Ticks per second
+Uint64 timer_frequency();
+
+// Ticks to microseconds and back
+Uint64 timer_to_us(Uint64 ticks);
+Uint64 timer_from_us(Uint64 us);
+
+// Sleeps for most of the time left until the deadline, then spins the rest
+// so it returns within a few microseconds of it. Returns at once if the
+// deadline already passed
+void timer_wait_until(Uint64 deadline);
+
+#endif
@@ -0,0 +1,63 @@
+#include "trans.h"
+
+#include <stdlib.h>
+
+bool trans_init(TransTable *t, int bits) {
+	t->mask = (1ull << bits) - 1;
+	t->entries = calloc(t->mask + 1, sizeof(TransEntry));
+	atomic_init(&t->probes, 0);
+	atomic_init(&t->hits, 0);
+	atomic_init(&t->stores, 0);
+	return t->entries != NULL;
+}
+
+void trans_free(TransTable *t) {
+	free(t->entries);
+	t->entries = NULL;
+}
+
+void trans_clear(TransTable *t) {
+	for(Uint64 i = 0; i <= t->mask; i++) {
+		atomic_store_explicit(&t->entries[i].check, 0, memory_order_relaxed);
+		atomic_store_explicit(&t->entries[i].data, 0, memory_order_relaxed);
+	}
+	atomic_store(&t->probes, 0);
+	atomic_store(&t->hits, 0);
+	atomic_store(&t->stores, 0);
+}
+
+// Keys are Zobrist hashes, already as mixed as they get
+static TransEntry *slot(TransTable *t, Uint64 key) {
+	return &t->entries[key & t->mask];
+}
+
+bool trans_probe(TransTable *t, Uint64 key, int *score, TransStats *stats) {
+	TransEntry *e = slot(t, key);
+	Uint64 check = atomic_load_explicit(&e->check, memory_order_relaxed);
+	Uint64 data = atomic_load_explicit(&e->data, memory_order_relaxed);
+	stats->probes++;
+	// An empty slot never matches, no key the search makes is 0
+	if((check ^ data) != key) return false;
+	stats->hits++;
+	*score = (int)(Uint32)data;
+	return true;
+}
+
+void trans_store(TransTable *t, Uint64 key, int score, TransStats *stats) {
+	TransEntry *e = slot(t, key);
+	Uint64 data = (Uint32)score;
+	atomic_store_explicit(&e->check, key ^ data, memory_order_relaxed);
+	atomic_store_explicit(&e->data, data, memory_order_relaxed);
+	stats->stores++;
+}
+
+void trans_add_stats(TransTable *t, const TransStats *stats) {
+	atomic_fetch_add_explicit(&t->probes, stats->probes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&t->hits, stats->hits, memory_order_relaxed);
+	atomic_fetch_add_explicit(&t->stores, stats->stores, memory_order_relaxed);
+}
+
+double trans_hit_rate(TransTable *t) {
+	Uint64 probes = atomic_load(&t->probes);
+	return probes ? (double)atomic_load(&t->hits) / probes : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef TETRIS_TRANS
+#define TETRIS_TRANS
+
+#include <stdatomic.h>
+
+#include "types.h"
+
+// Fixed size cache of positions the search has already scored, keyed by
+// game_hash. Any number of threads can share one without locks: an entry
+// keeps its key XORed with its data, so one torn by two threads writing
+// at once just stops matching instead of handing back the wrong score
+typedef struct {
+	_Atomic Uint64 check, data;
+} TransEntry;
+
+typedef struct {
+	TransEntry *entries;
+	Uint64 mask;
+	// Lookups, how many of them found the position, and positions stored
+	_Atomic Uint64 probes, hits, stores;
+} TransTable;
+
+// Counts a search keeps as it goes and adds to the table's once at the
+// end, so threads don't fight over the counters for every position
+typedef struct {
+	Uint64 probes, hits, stores;
+} TransStats;
+
+// Room for 1 << bits positions, false if it couldn't be allocated
+bool trans_init(TransTable *t, int bits);
+void trans_free(TransTable *t);
+
+// Forgets every position and resets the counters
+void trans_clear(TransTable *t);
+
+// Score stored for key, false if it isn't in the table
+bool trans_probe(TransTable *t, Uint64 key, int *score, TransStats *stats);
+
+// Keeps a score for key, replacing whatever shared its slot
+void trans_store(TransTable *t, Uint64 key, int score, TransStats *stats);
+
+void trans_add_stats(TransTable *t, const TransStats *stats);
+
+// Share of probes that hit so far, from 0 to 1
+double trans_hit_rate(TransTable *t);
+
+#endif
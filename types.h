@@ -0,0 +1,16 @@
+#ifndef TETRIS_TYPES
+#define TETRIS_TYPES
+
+#include <stdint.h>
+
+typedef unsigned char Uint8;
+typedef signed char Sint8;
+typedef unsigned short Uint16;
+typedef unsigned int Uint32;
+// Same definition SDL uses so the two can be included together
+typedef uint64_t Uint64;
+
+typedef unsigned char bool;
+enum {false,true};
+
+#endif